@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Collision.hpp"
+#include <array>
+#include <vector>
+
+// Dynamic AABB tree (BVH) that persists between frames. Leaves keep fattened
+// bounds, an object is reinserted only after it leaves its fat box.
+class AABBTreeDetector : public BroadPhaseDetector
+{
+	static constexpr size_t NULL_NODE = ~size_t(0);
+
+public:
+	AABBTreeDetector(float margin = 8.f, float velocityScale = 2.f);
+
+	virtual Pairs generatePairs() override;
+	virtual void queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const override;
+	virtual void traceRay(const Ray& ray, const RayVisitor& visit) const override;
+
+private:
+	virtual void onColliderAddition() override;
+
+	size_t allocateNode();
+	void freeNode(size_t node);
+	void insertLeaf(size_t leaf);
+	void removeLeaf(size_t leaf);
+	void refit(size_t node);
+	size_t balance(size_t node);
+	AABB fatten(const AABB& bounds, glm::vec2 displacement) const;
+
+private:
+	struct Node
+	{
+		AABB bounds;
+		size_t parent = NULL_NODE;
+		std::array<size_t, 2> children = { NULL_NODE, NULL_NODE };
+		CollisionID objectID = 0;
+		int height = 0;
+
+		bool isLeaf() const { return children[0] == NULL_NODE; }
+	};
+
+	std::vector<Node> mNodes;
+	size_t mRoot = NULL_NODE;
+	size_t mFreeList = NULL_NODE; // free nodes are chained through parent
+
+	std::vector<size_t> mLeaves;
+	std::vector<glm::vec2> mLastPositions;
+	std::vector<bool> mTracked; // mLastPositions was set by generatePairs()
+
+	float mMargin;
+	float mVelocityScale;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Collision.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Picks the broadphase for the current scene. Candidates and their parameters
+// are derived from the object count, size and density, each is timed on real
+// frames and the fastest one is kept. The scene is sampled periodically and
+// tuning restarts when it changed noticeably or the kept detector slowed down.
+class BroadPhaseTuner : public BroadPhaseDetector
+{
+	static constexpr size_t TRIAL_FRAMES = 4; // the first trial frame is a warm-up (initial build)
+	static constexpr size_t SAMPLE_INTERVAL = 60;
+	static constexpr double RETUNE_RATIO = 1.5;
+	static constexpr double SLOWDOWN_RATIO = 2.0;
+
+public:
+	BroadPhaseTuner() = default;
+
+	virtual Pairs generatePairs() override;
+	virtual const std::vector<AABB>& getBounds() const override;
+	virtual void setTransforms(std::span<const Transform> transforms) override;
+	virtual void setBounds(std::span<const AABB> bounds) override;
+	virtual void queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const override;
+	virtual void traceRay(const Ray& ray, const RayVisitor& visit) const override;
+
+	bool isTuning() const { return mTuning; }
+	const std::string& getSelectedName() const { return mCandidates[mCurrent].name; } // candidate in use, valid after generatePairs()
+
+private:
+	virtual void onColliderAddition() override;
+
+	struct SceneStats
+	{
+		size_t objectCount = 0;
+		float meanExtent = 0.f;
+		float density = 0.f; // summed AABB area over the area they span
+	};
+
+	struct Candidate
+	{
+		std::string name;
+		std::unique_ptr<BroadPhaseDetector> detector;
+		double bestTime;
+	};
+
+	static SceneStats measure(const std::vector<AABB>& bounds);
+	bool hasChanged(const SceneStats& stats) const;
+	void makeCandidates(const SceneStats& stats);
+	void addCandidate(std::string name, std::unique_ptr<BroadPhaseDetector>&& detector);
+	void selectFastest();
+
+private:
+	std::vector<Candidate> mCandidates;
+	BroadPhaseDetector* mLastRun = nullptr; // bounds are forwarded from it
+	size_t mCurrent = 0;
+	size_t mTrialFrame = 0;
+	bool mTuning = false;
+	bool mRetune = false;
+
+	SceneStats mTunedStats;
+	double mTunedTime = 0.0;
+	double mAverageTime = 0.0;
+	size_t mSampleFrame = 0;
+};
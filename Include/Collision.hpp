@@ -1,6 +1,10 @@
 ﻿#pragma once
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <omp.h>
+#include <optional>
 #include <vector>
 #include <span>
 
@@ -9,6 +13,224 @@ using Object = std::span<glm::vec2>;
 using CollisionID = size_t;
 using Pairs = std::vector<std::pair<CollisionID, CollisionID>>;
 
+// Concatenates the per thread buffers into merged, they're copied in parallel
+// to offsets given by a prefix sum of their sizes
+template <typename T>
+void mergeThreadBuffers(const std::vector<std::vector<T>>& buffers, std::vector<T>& merged)
+{
+	std::vector<size_t> offsets(buffers.size() + 1, 0);
+	for (size_t t = 0; t < buffers.size(); ++t)
+		offsets[t + 1] = offsets[t] + buffers[t].size();
+
+	merged.resize(offsets.back());
+
+	#pragma omp parallel for schedule(static)
+	for (size_t t = 0; t < buffers.size(); ++t)
+		std::copy(buffers[t].begin(), buffers[t].end(), merged.begin() + offsets[t]);
+}
+
+struct AABB
+{
+	glm::vec2 min;
+	glm::vec2 max;
+
+	AABB() = default;
+	AABB(glm::vec2 min, glm::vec2 max) : min(min), max(max) {}
+	explicit AABB(const Object& object);
+
+	bool intersects(const AABB& other) const
+	{
+		return min.x < other.max.x && max.x > other.min.x && min.y < other.max.y && max.y > other.min.y;
+	}
+
+	bool contains(const AABB& other) const
+	{
+		return min.x <= other.min.x && min.y <= other.min.y && max.x >= other.max.x && max.y >= other.max.y;
+	}
+
+	AABB merge(const AABB& other) const
+	{
+		return { glm::min(min, other.min), glm::max(max, other.max) };
+	}
+
+	bool operator==(const AABB& other) const
+	{
+		return min == other.min && max == other.max;
+	}
+};
+
+// Placement of a collider given in local space, world = position + rotated local.
+// rotation holds the cosine and sine of the angle.
+struct Transform
+{
+	glm::vec2 position = { 0.f, 0.f };
+	glm::vec2 rotation = { 1.f, 0.f };
+
+	glm::vec2 rotate(const glm::vec2& v) const { return { rotation.x * v.x - rotation.y * v.y, rotation.y * v.x + rotation.x * v.y }; }
+	glm::vec2 unrotate(const glm::vec2& v) const { return { rotation.x * v.x + rotation.y * v.y, rotation.x * v.y - rotation.y * v.x }; }
+	glm::vec2 apply(const glm::vec2& v) const { return position + rotate(v); }
+	bool isRotated() const { return rotation.x != 1.f || rotation.y != 0.f; }
+};
+
+struct ContactEvent
+{
+	enum class Type
+	{
+		Begin,
+		Persist,
+		End
+	};
+
+	Type type;
+	CollisionID first;
+	CollisionID second;
+};
+
+// segment from origin to origin + direction
+struct Ray
+{
+	glm::vec2 origin;
+	glm::vec2 direction;
+
+	// fraction where the ray, cut at limit, enters box; touching doesn't count
+	std::optional<float> enters(const AABB& box, float limit = 1.f) const
+	{
+		float enter = 0.f, exit = limit;
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			if (direction[axis] == 0.f)
+			{
+				if (origin[axis] <= box.min[axis] || origin[axis] >= box.max[axis])
+					return std::nullopt;
+				continue;
+			}
+
+			auto t0 = (box.min[axis] - origin[axis]) / direction[axis];
+			auto t1 = (box.max[axis] - origin[axis]) / direction[axis];
+			enter = std::max(enter, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+		}
+
+		if (enter < exit)
+			return enter;
+		return std::nullopt;
+	}
+};
+
+struct RayHit
+{
+	CollisionID id;
+	float fraction; // of the ray's direction where it enters the collider, 0 when it starts inside
+};
+
+// results of a batch of queries, hits of query i are ids[start[i] .. start[i + 1]]
+struct QueryResults
+{
+	std::vector<CollisionID> ids;
+	std::vector<size_t> start;
+
+	size_t size() const { return start.empty() ? 0 : start.size() - 1; }
+	std::span<const CollisionID> operator[](size_t i) const { return { ids.data() + start[i], start[i + 1] - start[i] }; }
+};
+
+// Runs query(i, scratch, hits) for every i < count in parallel, the query
+// appends its hits and may use scratch as it likes.
+template <typename Query>
+QueryResults runQueries(size_t count, Query&& query)
+{
+	QueryResults results;
+	results.start.assign(count + 1, 0);
+
+	// a static schedule hands every thread one ascending block of queries, so the
+	// thread buffers are copied to the offsets of their first query
+	std::vector<std::vector<CollisionID>> threadHits(omp_get_max_threads());
+	std::vector<size_t> threadFirst(threadHits.size(), count);
+
+	#pragma omp parallel
+	{
+		auto thread = omp_get_thread_num();
+		auto& hits = threadHits[thread];
+		std::vector<CollisionID> scratch;
+
+		#pragma omp for schedule(static)
+		for (size_t i = 0; i < count; ++i)
+		{
+			threadFirst[thread] = std::min(threadFirst[thread], i);
+			auto before = hits.size();
+			query(i, scratch, hits);
+			results.start[i + 1] = hits.size() - before;
+		}
+	}
+
+	for (size_t i = 1; i <= count; ++i)
+		results.start[i] += results.start[i - 1];
+
+	results.ids.resize(results.start.back());
+
+	#pragma omp parallel for schedule(static)
+	for (size_t t = 0; t < threadHits.size(); ++t)
+		if (threadFirst[t] < count)
+			std::copy(threadHits[t].begin(), threadHits[t].end(), results.ids.begin() + results.start[threadFirst[t]]);
+
+	return results;
+}
+
+// Walks the cells of a uniform grid in the order the ray crosses them (DDA),
+// starting at cell. Cell c spans gridOrigin + [c, c + 1) * cellSize, cells are
+// clamped to [first, last] so the border ones reach past them. visit(cell)
+// returns the cut of the ray, the walk ends at the first boundary beyond it.
+template <typename Visit>
+void walkCells(const Ray& ray, glm::ivec2 cell, glm::vec2 gridOrigin, float cellSize, glm::ivec2 first, glm::ivec2 last, Visit&& visit)
+{
+	// fractions of the ray where it crosses the next boundary on each axis, and between two of them
+	glm::ivec2 step(0);
+	glm::vec2 next(std::numeric_limits<float>::infinity());
+	glm::vec2 delta(0.f);
+
+	auto atBorder = [&](int axis) { return cell[axis] == (step[axis] > 0 ? last[axis] : first[axis]); };
+
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		auto direction = ray.direction[axis];
+		if (direction == 0.f)
+			continue;
+
+		step[axis] = direction > 0.f ? 1 : -1;
+		delta[axis] = cellSize / std::abs(direction);
+		if (!atBorder(axis))
+			next[axis] = (gridOrigin[axis] + (cell[axis] + (step[axis] > 0)) * cellSize - ray.origin[axis]) / direction;
+	}
+
+	for (;;)
+	{
+		auto limit = visit(cell);
+		auto axis = next.x < next.y ? 0 : 1;
+		if (next[axis] >= limit)
+			return;
+
+		cell[axis] += step[axis];
+		next[axis] = atBorder(axis) ? std::numeric_limits<float>::infinity() : next[axis] + delta[axis];
+	}
+}
+
+// Non-owning callback of BroadPhaseDetector::traceRay(), visit(id) tests one
+// collider and returns the fraction the ray is cut at from then on.
+class RayVisitor
+{
+public:
+	template <typename Visit>
+	RayVisitor(Visit& visit)
+		: mVisit(&visit)
+		, mCall([](void* visit, CollisionID id) { return (*static_cast<Visit*>(visit))(id); })
+	{}
+
+	float operator()(CollisionID id) const { return mCall(mVisit, id); }
+
+private:
+	void* mVisit;
+	float (*mCall)(void*, CollisionID);
+};
+
 class NarrowPhaseDetector
 {
 public:
@@ -17,7 +239,7 @@ public:
 		, mHullB(b)
 	{} 
 
-	virtual operator bool() = 0; // this probably killed performance
+	virtual operator bool() = 0; // per pair object, used by the visualizers - CollisionDetector takes a policy from NarrowPhase.hpp
 
 protected:
 	Hull mHullA;
@@ -27,23 +249,73 @@ protected:
 class BroadPhaseDetector
 {
 public:
+	virtual ~BroadPhaseDetector() = default;
 
 	void addCollider(Object object)
 	{
 		mObjects.emplace_back(object);
+		mLocalBounds.emplace_back(object);
 		onColliderAddition();
 	}
 
+	// Transform of every collider, read on each generatePairs(). Once set the
+	// objects are in local space and moving a collider only changes its
+	// transform, otherwise the vertices are in world space.
+	virtual void setTransforms(std::span<const Transform> transforms) { mTransforms = transforms; }
+	std::span<const Transform> getTransforms() const { return mTransforms; }
+
+	// World bounds of every collider written by the caller, e.g. in the pass
+	// that moves the colliders, read on each generatePairs() instead of
+	// computing them from the objects again.
+	virtual void setBounds(std::span<const AABB> bounds) { mSuppliedBounds = bounds; }
+
 	std::vector<Object>& getObjects() { return mObjects; }
 	Object& getObject(size_t i) { return mObjects[i]; }
+	virtual const std::vector<AABB>& getBounds() const { return mBounds; } // valid after generatePairs()
 
 	virtual Pairs generatePairs() = 0;
 
+	// Colliders whose bounds overlap region, each once. Detectors search their
+	// own structure, the default scans all bounds. Valid after generatePairs().
+	virtual void queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const;
+
+	// Visits the colliders whose bounds the ray enters before its current cut,
+	// each once and roughly front to back, so a closest hit query stops early.
+	// Detectors walk their own structure, the default filters queryBounds().
+	virtual void traceRay(const Ray& ray, const RayVisitor& visit) const;
+
+	// Spatial queries, candidates from queryBounds() and traceRay() are tested
+	// against the exact hulls. Touching a point or ray doesn't count, regions
+	// are tested by SATPolicy where it does.
+	std::vector<CollisionID> queryPoint(glm::vec2 point) const;
+	std::vector<CollisionID> queryRegion(const AABB& region) const;
+	std::vector<RayHit> queryRay(const Ray& ray) const; // sorted by fraction
+
+	// batched versions, the queries run in parallel; a ray reports its closest hit
+	QueryResults queryPoints(std::span<const glm::vec2> points) const;
+	QueryResults queryRegions(std::span<const AABB> regions) const;
+	std::vector<std::optional<RayHit>> queryRays(std::span<const Ray> rays) const;
+
 protected:
 	virtual void onColliderAddition() = 0;
+	void updateBounds();
+	AABB computeBounds(CollisionID id) const;
+
+private:
+	void collectPoint(glm::vec2 point, std::vector<CollisionID>& candidates, std::vector<CollisionID>& hits) const;
+	void collectRegion(const AABB& region, std::vector<CollisionID>& candidates, std::vector<CollisionID>& hits) const;
+	void collectRay(const Ray& ray, std::vector<RayHit>& hits) const;
+
+	bool containsPoint(CollisionID id, glm::vec2 point) const;
+	bool overlapsRegion(CollisionID id, const AABB& region) const;
+	std::optional<float> castRay(CollisionID id, const Ray& ray) const;
 
 protected:
 	std::vector<Object> mObjects;
+	std::vector<AABB> mBounds;
+	std::vector<AABB> mLocalBounds; // bounds of the objects as added
+	std::span<const Transform> mTransforms;
+	std::span<const AABB> mSuppliedBounds;
 
 };
 
@@ -53,28 +325,27 @@ public:
 	SpatialGrid(size_t gridSize);
 
 	virtual Pairs generatePairs() override;
+	virtual void queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const override;
+	virtual void traceRay(const Ray& ray, const RayVisitor& visit) const override;
 
 private:
 	virtual void onColliderAddition() override;
 	void makeBins();
+	glm::uvec2 getCell(glm::vec2 position) const;
 
 private:
-	std::vector<std::vector<CollisionID>> mBins;
+	struct CellRange
+	{
+		glm::uvec2 min;
+		glm::uvec2 max;
+	};
+
+	// bins in CSR layout, objects of cell i are mCellObjects[mCellStart[i] .. mCellStart[i + 1]]
+	std::vector<CollisionID> mCellObjects;
+	std::vector<size_t> mCellStart;
+	std::vector<size_t> mCellCursor;
+	std::vector<CellRange> mCellRanges;
+
 	glm::uvec2 mGridSpan;
 	size_t mGridSize;
 };
-
-class CollisionDetector
-{
-public:
-	void addCollider(Object object);
-	void setBroadPhaseDetector(std::unique_ptr<BroadPhaseDetector>&& detector);
-
-	void update();
-	std::vector<CollisionID> queryCollision(CollisionID id);
-	bool queryIsColliding(CollisionID id);
-
-private:
-	std::unique_ptr<BroadPhaseDetector> mBroadphase;
-	Pairs mCollisions;
-};
\ No newline at end of file
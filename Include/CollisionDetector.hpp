@@ -0,0 +1,575 @@
+#pragma once
+
+#include "Collision.hpp"
+#include "NarrowPhase.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <omp.h>
+#include <span>
+#include <vector>
+
+// Broadphase plus a narrowphase policy (GJKPolicy, SATPolicy or a user type
+// satisfying NarrowPhasePolicy), the policy test is inlined into update().
+template <NarrowPhasePolicy NarrowPhase>
+class BasicCollisionDetector
+{
+public:
+	void addCollider(Object object);
+	void setBroadPhaseDetector(std::unique_ptr<BroadPhaseDetector>&& detector);
+	const BroadPhaseDetector& getBroadPhaseDetector() const { return *mBroadphase; } // for spatial queries
+
+	// Transform of every collider, see BroadPhaseDetector::setTransforms().
+	// Hulls of transformed colliders are copied once when added, the others
+	// are read again on every update().
+	void setTransforms(std::span<const Transform> transforms);
+
+	// bounds written by the caller's motion pass, see BroadPhaseDetector::setBounds()
+	void setBounds(std::span<const AABB> bounds);
+
+	// Velocity of every collider in units per second, read on each update().
+	// With a ClearancePolicy, separated pairs then skip the narrowphase until
+	// they could have covered the distance between them. Colliders must not
+	// move faster than their velocity says, for rotating ones that's the
+	// speed of their fastest vertex.
+	void setVelocities(std::span<const glm::vec2> velocities) { mVelocities = velocities; }
+
+	void update(float dt);
+	std::vector<CollisionID> queryCollision(CollisionID id) const;
+	bool queryIsColliding(CollisionID id) const;
+
+	// colliders touching id after the last update(), sorted
+	std::span<const CollisionID> getContacts(CollisionID id) const;
+
+	// Colliders overlapping each of the world space probe hulls, by the
+	// broadphase state and narrowphase policy of the last update(). Probes
+	// aren't added to the world, nothing is rebuilt.
+	QueryResults queryOverlaps(std::span<const Hull> probes) const;
+
+	// contact changes since the previous update()
+	const std::vector<ContactEvent>& getContactEvents() const { return mContactEvents; }
+
+	// broadphase pairs rejected by the midphase in the last update()
+	size_t getMidphaseCulled() const { return mMidphaseCulled; }
+
+private:
+	// narrowphase result of a pair, kept while the broadphase keeps reporting it
+	struct CachedPair
+	{
+		CollisionID first;
+		CollisionID second;
+		AABB firstBounds;
+		AABB secondBounds;
+		bool colliding;
+		float clearance; // distance left before the pair may touch
+		typename NarrowPhaseCache<NarrowPhase>::type narrowPhase; // warm start state of the policy
+	};
+
+	void cullPairs(Pairs& pairs, const std::vector<AABB>& bounds);
+	void sortPairs(Pairs& pairs);
+	bool testPair(CachedPair& entry, float dt) const;
+	void storeHulls();
+	void buildContacts();
+	HullView getHull(CollisionID id) const;
+	void fitCircle(CollisionID id);
+	glm::vec2 getCenter(CollisionID id) const;
+
+private:
+
+	std::unique_ptr<BroadPhaseDetector> mBroadphase;
+	Pairs mCollisions;
+
+	// mCollisions per object in CSR layout, contacts of i are mContacts[mContactStart[i] .. mContactStart[i + 1]]
+	std::vector<CollisionID> mContacts;
+	std::vector<size_t> mContactStart;
+	std::vector<size_t> mContactCursor;
+	std::vector<uint64_t> mCollidingBits;
+	std::span<const glm::vec2> mVelocities;
+	std::span<const Transform> mTransforms;
+	std::span<const AABB> mSuppliedBounds;
+
+	// midphase, bounding circles are centered on the center of the object's AABB, in
+	// local space for transformed objects and refitted every update() for the others
+	std::vector<glm::vec2> mCenters;
+	std::vector<float> mRadii;
+	std::vector<uint32_t> mMidphaseMasks;
+	size_t mMidphaseCulled = 0;
+
+	// local space copies of the hulls for the SIMD kernels
+	std::vector<float> mHullX;
+	std::vector<float> mHullY;
+	std::vector<size_t> mHullStart;
+
+	// support maps are built once per collider, normals too unless the collider is in world space
+	std::vector<uint16_t> mSupportMaps;
+	std::vector<size_t> mSupportStart;
+	std::vector<size_t> mSupportBuckets;
+	std::vector<glm::vec2> mNormals;
+	std::vector<size_t> mNormalStart;
+	std::vector<size_t> mNormalCount;
+
+	std::vector<CachedPair> mPairCache; // sorted by (first, second), bucketed by first
+	std::vector<CachedPair> mNextPairCache;
+	std::vector<size_t> mCacheStart; // pairs of object i start at mCacheStart[i]
+	std::vector<size_t> mNextCacheStart;
+	std::vector<ContactEvent> mContactEvents;
+
+	// scratch of sortPairs() and per thread results of update()
+	std::vector<size_t> mPairStart;
+	std::vector<size_t> mPairCursor;
+	std::vector<CollisionID> mSortedSeconds;
+	std::vector<Pairs> mThreadCollisions;
+	std::vector<std::vector<ContactEvent>> mThreadEvents;
+};
+
+using CollisionDetector = BasicCollisionDetector<GJKPolicy>;
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::addCollider(Object object)
+{
+	mBroadphase->addCollider(object);
+
+	mCenters.emplace_back();
+	mRadii.emplace_back();
+	fitCircle(mRadii.size() - 1);
+
+	mHullStart.push_back(mHullX.size());
+	mHullX.resize(mHullX.size() + paddedHullSize(object.size()));
+	mHullY.resize(mHullX.size());
+	storeHull(object, &mHullX[mHullStart.back()], &mHullY[mHullStart.back()]);
+
+	auto buckets = supportMapBuckets(object);
+	mSupportStart.push_back(mSupportMaps.size());
+	mSupportBuckets.push_back(buckets);
+	mSupportMaps.resize(mSupportMaps.size() + buckets);
+	buildSupportMap(object, mSupportMaps.data() + mSupportStart.back(), buckets);
+
+	// room for every edge, normals of world space objects are rebuilt and their count may change
+	mNormalStart.push_back(mNormals.size());
+	mNormals.resize(mNormals.size() + object.size());
+	mNormalCount.push_back(buildHullNormals(object, mNormals.data() + mNormalStart.back()));
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::setBroadPhaseDetector(std::unique_ptr<BroadPhaseDetector>&& detector)
+{
+	mBroadphase.swap(detector);
+	mBroadphase->setTransforms(mTransforms);
+	mBroadphase->setBounds(mSuppliedBounds);
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::setTransforms(std::span<const Transform> transforms)
+{
+	mTransforms = transforms;
+	mBroadphase->setTransforms(transforms);
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::setBounds(std::span<const AABB> bounds)
+{
+	mSuppliedBounds = bounds;
+	mBroadphase->setBounds(bounds);
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::update(float dt)
+{
+	auto pairs = mBroadphase->generatePairs();
+	const auto& bounds = mBroadphase->getBounds();
+	storeHulls();
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < pairs.size(); ++i)
+		if (pairs[i].first > pairs[i].second)
+			std::swap(pairs[i].first, pairs[i].second);
+
+	cullPairs(pairs, bounds);
+	sortPairs(pairs);
+
+	// pairs and both caches are bucketed by the first object, a lookup only searches its bucket
+	auto findCached = [&](CollisionID first, CollisionID second) -> const CachedPair*
+	{
+		if (first + 1 >= mCacheStart.size())
+			return nullptr;
+
+		auto begin = mPairCache.begin() + mCacheStart[first];
+		auto end = mPairCache.begin() + mCacheStart[first + 1];
+		auto it = std::lower_bound(begin, end, second, [](const CachedPair& c, CollisionID id) { return c.second < id; });
+		return (it != end && it->second == second) ? &*it : nullptr;
+	};
+
+	auto isReported = [&](CollisionID first, CollisionID second)
+	{
+		auto begin = pairs.begin() + mNextCacheStart[first];
+		auto end = pairs.begin() + mNextCacheStart[first + 1];
+		return std::binary_search(begin, end, std::make_pair(first, second));
+	};
+
+	mNextPairCache.resize(pairs.size());
+	// all buffers are cleared here, the team may be smaller than the buffer count
+	mThreadCollisions.resize(omp_get_max_threads());
+	mThreadEvents.resize(omp_get_max_threads());
+	for (auto& c : mThreadCollisions)
+		c.clear();
+	for (auto& e : mThreadEvents)
+		e.clear();
+
+	#pragma omp parallel
+	{
+		auto& collisions = mThreadCollisions[omp_get_thread_num()];
+		auto& events = mThreadEvents[omp_get_thread_num()];
+
+		// consecutive pairs share their first hull, chunks keep a thread on nearby hull memory
+		#pragma omp for schedule(dynamic, 256) nowait
+		for (size_t i = 0; i < pairs.size(); ++i)
+		{
+			const auto& p = pairs[i];
+			auto& entry = mNextPairCache[i];
+			entry = { p.first, p.second, bounds[p.first], bounds[p.second], false, 0.f, {} };
+
+			auto cached = findCached(p.first, p.second);
+			bool wasColliding = cached && cached->colliding;
+
+			if (cached)
+			{
+				entry.narrowPhase = cached->narrowPhase;
+				entry.clearance = cached->clearance;
+			}
+
+			// a pair whose bounds didn't change since the last narrowphase keeps its result
+			if (cached && cached->firstBounds == entry.firstBounds && cached->secondBounds == entry.secondBounds)
+				entry.colliding = cached->colliding;
+			else
+				entry.colliding = testPair(entry, dt);
+
+			if (entry.colliding)
+			{
+				collisions.emplace_back(p.first, p.second);
+				events.push_back({ wasColliding ? ContactEvent::Type::Persist : ContactEvent::Type::Begin, p.first, p.second });
+			}
+			else if (wasColliding)
+				events.push_back({ ContactEvent::Type::End, p.first, p.second });
+		}
+
+		// contacts whose pair was dropped by the broadphase or midphase ended as well
+		#pragma omp for schedule(static)
+		for (size_t i = 0; i < mPairCache.size(); ++i)
+		{
+			const auto& cached = mPairCache[i];
+			if (cached.colliding && !isReported(cached.first, cached.second))
+				events.push_back({ ContactEvent::Type::End, cached.first, cached.second });
+		}
+	}
+
+	mergeThreadBuffers(mThreadCollisions, mCollisions);
+	mergeThreadBuffers(mThreadEvents, mContactEvents);
+	buildContacts();
+
+	mPairCache.swap(mNextPairCache);
+	mCacheStart.swap(mNextCacheStart);
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+bool BasicCollisionDetector<NarrowPhase>::testPair(CachedPair& entry, float dt) const
+{
+	// conservative advancement, the gap shrinks at most by the distance both objects travelled
+	bool tracked = ClearancePolicy<NarrowPhase> && entry.second < mVelocities.size();
+	if (tracked && entry.clearance > 0.f)
+	{
+		entry.clearance -= (glm::length(mVelocities[entry.first]) + glm::length(mVelocities[entry.second])) * dt;
+		if (entry.clearance > 0.f)
+			return false;
+	}
+
+	auto a = getHull(entry.first);
+	auto b = getHull(entry.second);
+
+	if constexpr (ClearancePolicy<NarrowPhase>)
+	{
+		// the same pass gives the clearance, only pairs with velocities need it
+		entry.clearance = 0.f;
+		if (tracked)
+			return NarrowPhase::intersects(a, b, entry.narrowPhase, entry.clearance);
+	}
+
+	if constexpr (WarmStartedPolicy<NarrowPhase>)
+		return NarrowPhase::intersects(a, b, entry.narrowPhase);
+	else
+		return NarrowPhase::intersects(a, b);
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::sortPairs(Pairs& pairs)
+{
+	// counting sort into buckets by the first object, then every bucket is sorted and deduplicated
+	size_t objectCount = mBroadphase->getObjects().size();
+	mPairStart.assign(objectCount + 1, 0);
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < pairs.size(); ++i)
+	{
+		#pragma omp atomic
+		++mPairStart[pairs[i].first + 1];
+	}
+
+	for (size_t i = 1; i <= objectCount; ++i)
+		mPairStart[i] += mPairStart[i - 1];
+
+	mPairCursor.assign(mPairStart.begin(), mPairStart.end() - 1);
+	mSortedSeconds.resize(pairs.size());
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < pairs.size(); ++i)
+	{
+		size_t slot;
+		#pragma omp atomic capture
+		slot = mPairCursor[pairs[i].first]++;
+
+		mSortedSeconds[slot] = pairs[i].second;
+	}
+
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (size_t i = 0; i < objectCount; ++i)
+	{
+		auto begin = mSortedSeconds.begin() + mPairStart[i];
+		auto end = mSortedSeconds.begin() + mPairStart[i + 1];
+		std::sort(begin, end);
+		mPairCursor[i] = std::unique(begin, end) - begin;
+	}
+
+	mNextCacheStart.resize(objectCount + 1);
+	mNextCacheStart[0] = 0;
+	for (size_t i = 0; i < objectCount; ++i)
+		mNextCacheStart[i + 1] = mNextCacheStart[i] + mPairCursor[i];
+
+	pairs.resize(mNextCacheStart.back());
+
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (size_t i = 0; i < objectCount; ++i)
+		for (size_t k = 0; k < mPairCursor[i]; ++k)
+			pairs[mNextCacheStart[i] + k] = { i, mSortedSeconds[mPairStart[i] + k] };
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::cullPairs(Pairs& pairs, const std::vector<AABB>& bounds)
+{
+	constexpr size_t batchSize = AABB_BATCH_SIZE;
+	size_t batchCount = (pairs.size() + batchSize - 1) / batchSize;
+	mMidphaseMasks.resize(batchCount);
+
+	// batches of pairs are gathered into arrays, [0] for the first objects, [1] for the second ones
+	#pragma omp parallel for schedule(static)
+	for (size_t batch = 0; batch < batchCount; ++batch)
+	{
+		float minX[2][batchSize], minY[2][batchSize], maxX[2][batchSize], maxY[2][batchSize];
+		float x[2][batchSize], y[2][batchSize], radius[2][batchSize];
+
+		size_t begin = batch * batchSize;
+		size_t count = std::min(batchSize, pairs.size() - begin);
+
+		for (size_t k = 0; k < batchSize; ++k)
+		{
+			const auto& p = pairs[begin + std::min(k, count - 1)];
+			CollisionID ids[2] = { p.first, p.second };
+
+			for (size_t side = 0; side < 2; ++side)
+			{
+				const auto& box = bounds[ids[side]];
+				minX[side][k] = box.min.x;
+				minY[side][k] = box.min.y;
+				maxX[side][k] = box.max.x;
+				maxY[side][k] = box.max.y;
+				auto center = getCenter(ids[side]);
+				x[side][k] = center.x;
+				y[side][k] = center.y;
+				radius[side][k] = mRadii[ids[side]];
+			}
+		}
+
+		auto mask = boxPairMask(minX[0], minY[0], maxX[0], maxY[0], minX[1], minY[1], maxX[1], maxY[1])
+			& circlePairMask(x[0], y[0], radius[0], x[1], y[1], radius[1]);
+
+		mMidphaseMasks[batch] = mask & ((1u << count) - 1);
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < pairs.size(); ++i)
+		if (mMidphaseMasks[i / batchSize] & (1u << (i % batchSize)))
+			pairs[kept++] = pairs[i];
+
+	mMidphaseCulled = pairs.size() - kept;
+	pairs.resize(kept);
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::storeHulls()
+{
+	#pragma omp parallel for schedule(static)
+	for (CollisionID i = mTransforms.size(); i < mHullStart.size(); ++i)
+	{
+		const auto& object = mBroadphase->getObject(i);
+		storeHull(object, &mHullX[mHullStart[i]], &mHullY[mHullStart[i]]);
+		mNormalCount[i] = buildHullNormals(object, &mNormals[mNormalStart[i]]);
+		fitCircle(i);
+	}
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::fitCircle(CollisionID id)
+{
+	const auto& object = mBroadphase->getObject(id);
+	AABB bounds(object);
+	auto center = (bounds.min + bounds.max) * 0.5f;
+
+	float radius = 0.f;
+	for (const auto& v : object)
+		radius = std::max(radius, glm::length(v - center));
+
+	mCenters[id] = center;
+	mRadii[id] = radius;
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+HullView BasicCollisionDetector<NarrowPhase>::getHull(CollisionID id) const
+{
+	HullView hull = { &mHullX[mHullStart[id]], &mHullY[mHullStart[id]], mBroadphase->getObject(id).size() };
+	hull.normals = mNormals.data() + mNormalStart[id];
+	hull.normalCount = mNormalCount[id];
+	if (id < mTransforms.size())
+		hull.transform = mTransforms[id];
+
+	if (mSupportBuckets[id] > 0)
+	{
+		hull.supportMap = &mSupportMaps[mSupportStart[id]];
+		hull.supportBuckets = mSupportBuckets[id];
+	}
+
+	return hull;
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+glm::vec2 BasicCollisionDetector<NarrowPhase>::getCenter(CollisionID id) const
+{
+	if (id < mTransforms.size())
+		return mTransforms[id].apply(mCenters[id]);
+	return mCenters[id];
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+void BasicCollisionDetector<NarrowPhase>::buildContacts()
+{
+	// counting sort of both ends of every collision, like the pairs in sortPairs()
+	size_t objectCount = mBroadphase->getObjects().size();
+	mContactStart.assign(objectCount + 1, 0);
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < mCollisions.size(); ++i)
+	{
+		#pragma omp atomic
+		++mContactStart[mCollisions[i].first + 1];
+		#pragma omp atomic
+		++mContactStart[mCollisions[i].second + 1];
+	}
+
+	for (size_t i = 1; i <= objectCount; ++i)
+		mContactStart[i] += mContactStart[i - 1];
+
+	mContactCursor.assign(mContactStart.begin(), mContactStart.end() - 1);
+	mContacts.resize(mContactStart.back());
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < mCollisions.size(); ++i)
+	{
+		const auto& c = mCollisions[i];
+		size_t first, second;
+
+		#pragma omp atomic capture
+		first = mContactCursor[c.first]++;
+		#pragma omp atomic capture
+		second = mContactCursor[c.second]++;
+
+		mContacts[first] = c.second;
+		mContacts[second] = c.first;
+	}
+
+	// every thread owns whole words of the bitset
+	mCollidingBits.assign((objectCount + 63) / 64, 0);
+
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (size_t word = 0; word < mCollidingBits.size(); ++word)
+	{
+		uint64_t bits = 0;
+		for (size_t i = word * 64; i < std::min(word * 64 + 64, objectCount); ++i)
+		{
+			std::sort(mContacts.begin() + mContactStart[i], mContacts.begin() + mContactStart[i + 1]);
+			if (mContactStart[i + 1] > mContactStart[i])
+				bits |= uint64_t(1) << (i % 64);
+		}
+
+		mCollidingBits[word] = bits;
+	}
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+std::span<const CollisionID> BasicCollisionDetector<NarrowPhase>::getContacts(CollisionID id) const
+{
+	if (id + 1 >= mContactStart.size())
+		return {};
+	return { mContacts.data() + mContactStart[id], mContactStart[id + 1] - mContactStart[id] };
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+QueryResults BasicCollisionDetector<NarrowPhase>::queryOverlaps(std::span<const Hull> probes) const
+{
+	// probes get the same SoA copies and normals as the colliders, all in one buffer
+	std::vector<size_t> hullStart(probes.size() + 1, 0);
+	std::vector<size_t> normalStart(probes.size() + 1, 0);
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		hullStart[i + 1] = hullStart[i] + paddedHullSize(probes[i].size());
+		normalStart[i + 1] = normalStart[i] + probes[i].size();
+	}
+
+	std::vector<float> hullX(hullStart.back());
+	std::vector<float> hullY(hullStart.back());
+	std::vector<glm::vec2> normals(normalStart.back());
+	std::vector<size_t> normalCount(probes.size());
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		storeHull(probes[i], &hullX[hullStart[i]], &hullY[hullStart[i]]);
+		normalCount[i] = buildHullNormals(probes[i], &normals[normalStart[i]]);
+	}
+
+	return runQueries(probes.size(), [&](size_t i, std::vector<CollisionID>& candidates, std::vector<CollisionID>& hits)
+	{
+		if (probes[i].empty())
+			return;
+
+		HullView probe = { &hullX[hullStart[i]], &hullY[hullStart[i]], probes[i].size() };
+		probe.normals = &normals[normalStart[i]];
+		probe.normalCount = normalCount[i];
+
+		candidates.clear();
+		mBroadphase->queryBounds(AABB(probes[i]), candidates);
+
+		for (auto id : candidates)
+			if (NarrowPhase::intersects(probe, getHull(id)))
+				hits.emplace_back(id);
+	});
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+std::vector<CollisionID> BasicCollisionDetector<NarrowPhase>::queryCollision(CollisionID id) const
+{
+	auto contacts = getContacts(id);
+	return { contacts.begin(), contacts.end() };
+}
+
+template <NarrowPhasePolicy NarrowPhase>
+bool BasicCollisionDetector<NarrowPhase>::queryIsColliding(CollisionID id) const
+{
+	return id / 64 < mCollidingBits.size() && (mCollidingBits[id / 64] >> (id % 64) & 1);
+}
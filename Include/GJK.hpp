@@ -6,6 +6,7 @@
 
 #include "Visualization.hpp"
 #include "Collision.hpp"
+#include "NarrowPhase.hpp"
 
 class GJK : public NarrowPhaseDetector
 {
@@ -14,8 +15,12 @@ public:
 	virtual operator bool() override;
 
 protected:
+	void setHulls(const Hull& a, const Hull& b);
 	glm::vec2 support(const glm::vec2& direction);
 
+	// SIMD copies of the hulls, built whenever the hulls are set
+	HullStorage mStorageA;
+	HullStorage mStorageB;
 };
 
 class GJKVisualizer : public Visualization, protected GJK 
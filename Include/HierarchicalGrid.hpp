@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Collision.hpp"
+#include <cstdint>
+#include <vector>
+
+// Multi-level grid with sparse, hashed cells. Level L has cells of
+// cellSize * 2^L, every object lives in the level matching its extent, so it
+// covers at most 2x2 cells there. Nothing is sized from AREA_SIZE.
+class HierarchicalGrid : public BroadPhaseDetector
+{
+	static constexpr size_t MAX_LEVELS = 32;
+	static constexpr uint64_t EMPTY_KEY = ~uint64_t(0);
+
+public:
+	HierarchicalGrid(float cellSize = 64.f, size_t levels = 12);
+
+	virtual Pairs generatePairs() override;
+	virtual void queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const override;
+	virtual void traceRay(const Ray& ray, const RayVisitor& visit) const override;
+
+private:
+	virtual void onColliderAddition() override;
+	void makeCells();
+	glm::ivec2 getCell(glm::vec2 position, size_t level) const;
+	uint64_t getKey(glm::ivec2 cell, size_t level) const;
+
+private:
+	struct Placement
+	{
+		glm::ivec2 min;
+		glm::ivec2 max;
+		size_t level;
+	};
+
+	struct Entry
+	{
+		uint64_t key;
+		CollisionID objectID;
+	};
+
+	struct Cell
+	{
+		uint64_t key = EMPTY_KEY;
+		size_t begin;
+		size_t end;
+	};
+
+	const Cell* findCell(uint64_t key) const;
+
+	std::vector<Placement> mPlacements;
+	std::vector<size_t> mEntryStart;
+	std::vector<Entry> mEntries; // sorted by cell key, a cell is a run of entries
+	std::vector<Cell> mTable;    // open addressing, capacity is a power of 2
+	uint64_t mUsedLevels = 0;
+
+	float mCellSize;
+	size_t mLevels;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Collision.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Linear BVH rebuilt every frame (Karras 2012). Objects are ordered by the
+// Morton code of their AABB center, every stage - radix sort, hierarchy
+// build, refit and traversal - runs in parallel without critical sections.
+class LBVHDetector : public BroadPhaseDetector
+{
+	static constexpr uint32_t LEAF_FLAG = 0x80000000u;
+	static constexpr uint32_t NULL_NODE = ~uint32_t(0);
+
+public:
+	LBVHDetector() = default;
+
+	virtual Pairs generatePairs() override;
+	virtual void queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const override;
+	virtual void traceRay(const Ray& ray, const RayVisitor& visit) const override;
+
+private:
+	virtual void onColliderAddition() override;
+
+	void computeMortonCodes();
+	void sortMortonCodes();
+	void buildHierarchy();
+	void refitBounds();
+	int delta(int i, int j) const;
+
+private:
+	struct Node
+	{
+		AABB bounds;
+		uint32_t children[2]; // LEAF_FLAG marks an index into the sorted leaves
+		uint32_t parent;
+		uint32_t last; // highest leaf index under this node
+	};
+
+	std::vector<uint32_t> mMortonCodes;
+	std::vector<uint32_t> mSortedIDs;
+	std::vector<uint32_t> mTempCodes;
+	std::vector<uint32_t> mTempIDs;
+	std::vector<size_t> mHistograms;
+
+	std::vector<Node> mNodes; // internal nodes, root is mNodes[0]
+	std::vector<AABB> mLeafBounds;
+	std::vector<uint32_t> mLeafParents;
+	std::unique_ptr<std::atomic<uint32_t>[]> mVisits;
+	size_t mVisitsSize = 0;
+
+	std::vector<Pairs> mThreadPairs;
+};
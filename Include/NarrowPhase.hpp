@@ -0,0 +1,651 @@
+#pragma once
+
+#include "Collision.hpp"
+#include "SIMD.hpp"
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Hull vertices in the layout of the SIMD kernels, x and y are padded to
+// paddedHullSize(size). supportMap is optional, see buildSupportMap(),
+// normals are required by SATPolicy, see buildHullNormals(). Vertices and
+// normals are in local space, operator[] places them with transform.
+struct HullView
+{
+	const float* x;
+	const float* y;
+	size_t size;
+	const uint16_t* supportMap = nullptr;
+	size_t supportBuckets = 0;
+	const glm::vec2* normals = nullptr;
+	size_t normalCount = 0;
+	Transform transform = {};
+
+	glm::vec2 operator[](size_t i) const { return transform.apply({ x[i], y[i] }); }
+	size_t paddedSize() const { return paddedHullSize(size); }
+	float dot(size_t i, const glm::vec2& localDirection) const { return x[i] * localDirection.x + y[i] * localDirection.y; }
+};
+
+// smaller hulls are scanned by maxDotIndex() in a batch or two, that's as fast as the lookup
+constexpr size_t SUPPORT_MAP_MIN_VERTICES = 2 * HULL_BATCH_SIZE;
+constexpr size_t SUPPORT_MAP_MAX_BUCKETS = 1024;
+
+// Pseudo angle of a direction in [0, 4), monotonic with the real angle but
+// without atan2. Zero direction maps to 0.
+inline float diamondAngle(const glm::vec2& d)
+{
+	auto sum = std::abs(d.x) + std::abs(d.y);
+	if (sum == 0.f)
+		return 0.f;
+
+	if (d.y >= 0.f)
+		return d.x >= 0.f ? d.y / sum : 1.f - d.x / sum;
+	return d.x < 0.f ? 2.f - d.y / sum : 3.f + d.x / sum;
+}
+
+inline glm::vec2 diamondDirection(float angle)
+{
+	if (angle < 1.f) return { 1.f - angle, angle };
+	if (angle < 2.f) return { 1.f - angle, 2.f - angle };
+	if (angle < 3.f) return { angle - 3.f, 2.f - angle };
+	return { angle - 3.f, angle - 4.f };
+}
+
+// Buckets of the support map of hull, 0 when the hull doesn't get one. The map
+// needs vertices ordered along a strictly convex outline, so the dot product
+// with any direction is unimodal over the vertex cycle.
+inline size_t supportMapBuckets(const Hull& hull)
+{
+	if (hull.size() < SUPPORT_MAP_MIN_VERTICES || hull.size() > UINT16_MAX)
+		return 0;
+
+	float winding = 0.f;
+	for (size_t i = 0; i < hull.size(); ++i)
+	{
+		auto e0 = hull[(i + 1) % hull.size()] - hull[i];
+		auto e1 = hull[(i + 2) % hull.size()] - hull[(i + 1) % hull.size()];
+		auto cross = e0.x * e1.y - e0.y * e1.x;
+
+		if (cross == 0.f || cross * winding < 0.f)
+			return 0;
+		winding = cross;
+	}
+
+	return std::min(std::bit_ceil(2 * hull.size()), SUPPORT_MAP_MAX_BUCKETS);
+}
+
+// Extreme vertex for the center direction of every pseudo angle bucket. The
+// map is built in local space, lookups rotate the direction into it.
+inline void buildSupportMap(const Hull& hull, uint16_t* map, size_t buckets)
+{
+	for (size_t b = 0; b < buckets; ++b)
+	{
+		auto direction = diamondDirection((b + 0.5f) * 4.f / buckets);
+
+		size_t best = 0;
+		for (size_t i = 1; i < hull.size(); ++i)
+			if (glm::dot(hull[i], direction) > glm::dot(hull[best], direction))
+				best = i;
+
+		map[b] = static_cast<uint16_t>(best);
+	}
+}
+
+// writes paddedHullSize(hull.size()) floats to both x and y
+inline void storeHull(const Hull& hull, float* x, float* y)
+{
+	for (size_t i = 0; i < paddedHullSize(hull.size()); ++i)
+	{
+		const auto& v = hull[i < hull.size() ? i : 0];
+		x[i] = v.x;
+		y[i] = v.y;
+	}
+}
+
+// Unit edge normals of hull, parallel and antiparallel ones are written only
+// once since they give the same SAT axis. Writes at most hull.size() normals,
+// returns their count. They're kept in local space like the hull.
+inline size_t buildHullNormals(const Hull& hull, glm::vec2* normals)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < hull.size(); ++i)
+	{
+		auto edge = hull[(i + 1) % hull.size()] - hull[i];
+		if (edge == glm::vec2(0.f))
+			continue;
+
+		auto normal = glm::normalize(glm::vec2(edge.y, -edge.x));
+		bool duplicate = false;
+
+		for (size_t j = 0; j < count && !duplicate; ++j)
+			duplicate = std::abs(normal.x * normals[j].y - normal.y * normals[j].x) < 1e-6f;
+
+		if (!duplicate)
+			normals[count++] = normal;
+	}
+
+	return count;
+}
+
+// owning copy of a single hull, for callers outside of CollisionDetector
+struct HullStorage
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<glm::vec2> normals;
+	size_t size;
+
+	explicit HullStorage(const Hull& hull)
+		: x(paddedHullSize(hull.size()))
+		, y(paddedHullSize(hull.size()))
+		, normals(hull.size())
+		, size(hull.size())
+	{
+		storeHull(hull, x.data(), y.data());
+		normals.resize(buildHullNormals(hull, normals.data()));
+	}
+
+	HullView view() const { return { x.data(), y.data(), size, nullptr, 0, normals.data(), normals.size() }; }
+};
+
+// Narrowphase policies for CollisionDetector. A policy is a type with a static
+// intersects(a, b), it's called directly per pair so the test gets inlined.
+template <typename T>
+concept NarrowPhasePolicy = requires(const HullView& a, const HullView& b)
+{
+	{ T::intersects(a, b) } -> std::convertible_to<bool>;
+};
+
+// A policy may also keep per pair state between frames, CollisionDetector then
+// stores a T::Cache with every pair and calls intersects(a, b, cache).
+template <typename T>
+concept WarmStartedPolicy = NarrowPhasePolicy<T> && requires(const HullView& a, const HullView& b, typename T::Cache& cache)
+{
+	{ T::intersects(a, b, cache) } -> std::convertible_to<bool>;
+};
+
+// A warm started policy with intersects(a, b, cache, clearance), which also
+// gives a lower bound of the distance of separated hulls in the same pass,
+// lets CollisionDetector skip pairs that can't have closed the gap yet.
+template <typename T>
+concept ClearancePolicy = WarmStartedPolicy<T> && requires(const HullView& a, const HullView& b, typename T::Cache& cache, float& clearance)
+{
+	{ T::intersects(a, b, cache, clearance) } -> std::convertible_to<bool>;
+};
+
+template <typename T>
+struct NarrowPhaseCache
+{
+	struct type {};
+};
+
+template <WarmStartedPolicy T>
+struct NarrowPhaseCache<T>
+{
+	using type = typename T::Cache;
+};
+
+struct GJKPolicy
+{
+	static constexpr size_t DISTANCE_MAX_ITERATIONS = 64;
+	static constexpr float DISTANCE_TOLERANCE = 1e-5f;
+
+	// Per pair state carried between frames. A separated pair keeps its last
+	// search direction, for coherent motion it usually separates again after
+	// one support call. A colliding pair keeps the vertex indices of its
+	// enclosing simplex, while the rebuilt simplex still encloses the origin
+	// no support call is needed at all.
+	struct Cache
+	{
+		glm::vec2 direction = { 1, 0 };
+		uint32_t simplexA[3];
+		uint32_t simplexB[3];
+		bool enclosing = false;
+	};
+
+	static bool intersects(const HullView& a, const HullView& b)
+	{
+		Cache cache;
+		return intersects(a, b, cache);
+	}
+
+	static bool intersects(const HullView& a, const HullView& b, Cache& cache)
+	{
+		struct Vertex
+		{
+			glm::vec2 point;
+			uint32_t indexA;
+			uint32_t indexB;
+		};
+
+		auto supportVertex = [&](const glm::vec2& direction) -> Vertex
+		{
+			auto i = static_cast<uint32_t>(furthestPoint(a, direction));
+			auto j = static_cast<uint32_t>(furthestPoint(b, -direction));
+			return { a[i] - b[j], i, j };
+		};
+
+		Vertex simplex[3];
+
+		if (cache.enclosing)
+		{
+			for (size_t k = 0; k < 3; ++k)
+				simplex[k] = { a[cache.simplexA[k]] - b[cache.simplexB[k]], cache.simplexA[k], cache.simplexB[k] };
+
+			if (enclosesOrigin(simplex[0].point, simplex[1].point, simplex[2].point))
+				return true;
+
+			cache.enclosing = false;
+		}
+
+		glm::vec2 direction = glm::dot(cache.direction, cache.direction) > 0.f ? cache.direction : glm::vec2(1, 0);
+
+		// simplex 0 - point (edge case)
+		simplex[0] = supportVertex(direction);
+		if (glm::dot(simplex[0].point, direction) <= 0.f)
+		{
+			cache.direction = direction;
+			return false;
+		}
+
+		direction = -simplex[0].point;
+
+		// simplex 1 - line (edge case)
+		simplex[1] = supportVertex(direction);
+		if (glm::dot(simplex[1].point, direction) <= 0.f)
+		{
+			cache.direction = direction;
+			return false;
+		}
+
+		glm::vec2 ab = simplex[0].point - simplex[1].point;
+		direction = tripleProduct(ab, -simplex[1].point, ab); // normal to AB towards origin
+		if (glm::dot(direction, direction) == 0.f)
+			direction = { ab.y, -ab.x };
+
+		while (true)
+		{
+			simplex[2] = supportVertex(direction);
+			if (glm::dot(simplex[2].point, direction) <= 0.f)
+			{
+				cache.direction = direction;
+				return false;
+			}
+
+			glm::vec2 ao = -simplex[2].point;
+			ab = simplex[1].point - simplex[2].point;
+			glm::vec2 ac = simplex[0].point - simplex[2].point;
+			glm::vec2 acn = tripleProduct(ab, ac, ac); // normal to AC
+
+			if (glm::dot(acn, ao) >= 0.f)
+				direction = acn;
+			else
+			{
+				glm::vec2 abn = tripleProduct(ac, ab, ab); // normal to AB
+				if (glm::dot(abn, ao) < 0.f)
+				{
+					for (size_t k = 0; k < 3; ++k)
+					{
+						cache.simplexA[k] = simplex[k].indexA;
+						cache.simplexB[k] = simplex[k].indexB;
+					}
+					cache.enclosing = true;
+					return true;
+				}
+
+				simplex[0] = simplex[1];
+				direction = abn;
+			}
+
+			simplex[1] = simplex[2];
+		}
+	}
+
+	// intersects() and clearance() from a single distance query sharing the cache,
+	// clearance is 0 for intersecting hulls
+	static bool intersects(const HullView& a, const HullView& b, Cache& cache, float& clearance)
+	{
+		clearance = distance(a, b, cache).lowerBound;
+		if (clearance > 0.f)
+			return false;
+
+		if (cache.enclosing)
+			return true;
+
+		// the origin lies on the simplex, the hulls touch or the query didn't converge
+		clearance = 0.f;
+		return intersects(a, b, cache);
+	}
+
+	struct Distance
+	{
+		float distance; // 0 when the hulls intersect
+		float lowerBound; // best support plane distance, never above the exact one
+		glm::vec2 pointA; // closest points, valid when distance > 0
+		glm::vec2 pointB;
+	};
+
+	static Distance distance(const HullView& a, const HullView& b)
+	{
+		Cache cache;
+		return distance(a, b, cache);
+	}
+
+	// GJK distance query, the simplex is reduced to the feature closest to
+	// the origin until the support point doesn't get closer to it. Warm started
+	// like intersects(), an enclosing simplex goes to the cache and so does the
+	// direction to the closest point of separated hulls.
+	static Distance distance(const HullView& a, const HullView& b, Cache& cache)
+	{
+		struct Vertex
+		{
+			glm::vec2 point;
+			uint32_t indexA;
+			uint32_t indexB;
+			float weight;
+		};
+
+		auto supportVertex = [&](const glm::vec2& direction) -> Vertex
+		{
+			auto i = static_cast<uint32_t>(furthestPoint(a, direction));
+			auto j = static_cast<uint32_t>(furthestPoint(b, -direction));
+			return { a[i] - b[j], i, j, 1.f };
+		};
+
+		// reduces simplex to the segment's feature closest to the origin
+		auto closestOnSegment = [](Vertex* simplex, size_t& size)
+		{
+			auto ab = simplex[1].point - simplex[0].point;
+			float t = glm::dot(-simplex[0].point, ab) / glm::dot(ab, ab);
+
+			if (!(t > 0.f)) // also catches a degenerate segment
+			{
+				size = 1;
+				simplex[0].weight = 1.f;
+			}
+			else if (t >= 1.f)
+			{
+				size = 1;
+				simplex[0] = simplex[1];
+				simplex[0].weight = 1.f;
+			}
+			else
+			{
+				simplex[0].weight = 1.f - t;
+				simplex[1].weight = t;
+			}
+		};
+
+		auto closestPoint = [](const Vertex* simplex, size_t size)
+		{
+			glm::vec2 v(0.f);
+			for (size_t k = 0; k < size; ++k)
+				v += simplex[k].point * simplex[k].weight;
+			return v;
+		};
+
+		Vertex simplex[3];
+
+		if (cache.enclosing)
+		{
+			for (size_t k = 0; k < 3; ++k)
+				simplex[k] = { a[cache.simplexA[k]] - b[cache.simplexB[k]], cache.simplexA[k], cache.simplexB[k], 1.f };
+
+			if (enclosesOrigin(simplex[0].point, simplex[1].point, simplex[2].point))
+				return { 0.f, 0.f, {}, {} };
+
+			cache.enclosing = false;
+		}
+
+		// the support point along the last separating direction is usually close to the closest one
+		simplex[0] = supportVertex(glm::dot(cache.direction, cache.direction) > 0.f ? cache.direction : glm::vec2(1, 0));
+		size_t size = 1;
+		glm::vec2 v = simplex[0].point;
+		float lowerBound = 0.f;
+
+		for (size_t iteration = 0; iteration < DISTANCE_MAX_ITERATIONS; ++iteration)
+		{
+			float vv = glm::dot(v, v);
+			if (vv == 0.f)
+				return { 0.f, 0.f, {}, {} };
+
+			auto w = supportVertex(-v);
+			lowerBound = std::max(lowerBound, glm::dot(v, w.point) / std::sqrt(vv));
+
+			bool known = false;
+			for (size_t k = 0; k < size; ++k)
+				known |= simplex[k].indexA == w.indexA && simplex[k].indexB == w.indexB;
+
+			if (known || vv - glm::dot(v, w.point) <= DISTANCE_TOLERANCE * vv)
+				break;
+
+			simplex[size++] = w;
+
+			if (size == 2)
+				closestOnSegment(simplex, size);
+			else
+			{
+				if (enclosesOrigin(simplex[0].point, simplex[1].point, simplex[2].point))
+				{
+					for (size_t k = 0; k < 3; ++k)
+					{
+						cache.simplexA[k] = simplex[k].indexA;
+						cache.simplexB[k] = simplex[k].indexB;
+					}
+					cache.enclosing = true;
+					return { 0.f, 0.f, {}, {} };
+				}
+
+				// the closest feature of the triangle lies on one of its edges
+				Vertex best[2];
+				size_t bestSize = 0;
+				float bestDistance = std::numeric_limits<float>::max();
+
+				for (size_t k = 0; k < 3; ++k)
+				{
+					Vertex edge[2] = { simplex[k], simplex[(k + 1) % 3] };
+					size_t edgeSize = 2;
+					closestOnSegment(edge, edgeSize);
+
+					auto p = closestPoint(edge, edgeSize);
+					if (float distance = glm::dot(p, p); distance < bestDistance)
+					{
+						bestDistance = distance;
+						best[0] = edge[0];
+						best[1] = edge[1];
+						bestSize = edgeSize;
+					}
+				}
+
+				simplex[0] = best[0];
+				simplex[1] = best[1];
+				size = bestSize;
+			}
+
+			v = closestPoint(simplex, size);
+		}
+
+		cache.direction = -v;
+
+		Distance result = { glm::length(v), lowerBound, glm::vec2(0.f), glm::vec2(0.f) };
+		for (size_t k = 0; k < size; ++k)
+		{
+			result.pointA += a[simplex[k].indexA] * simplex[k].weight;
+			result.pointB += b[simplex[k].indexB] * simplex[k].weight;
+		}
+
+		return result;
+	}
+
+	// lower bound of the distance of separated hulls
+	static float clearance(const HullView& a, const HullView& b)
+	{
+		return distance(a, b).lowerBound;
+	}
+
+	// strictly inside, touching hulls don't collide
+	static bool enclosesOrigin(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+	{
+		auto side = [](const glm::vec2& p, const glm::vec2& q)
+		{
+			return p.x * q.y - p.y * q.x; // cross(q - p, -p)
+		};
+
+		float ab = side(a, b);
+		float bc = side(b, c);
+		float ca = side(c, a);
+		return (ab > 0.f && bc > 0.f && ca > 0.f) || (ab < 0.f && bc < 0.f && ca < 0.f);
+	}
+
+	// furthest point of the Minkowski difference a - b along direction
+	static glm::vec2 support(const HullView& a, const HullView& b, const glm::vec2& direction)
+	{
+		return a[furthestPoint(a, direction)] - b[furthestPoint(b, -direction)];
+	}
+
+	static size_t furthestPoint(const HullView& hull, const glm::vec2& worldDirection)
+	{
+		auto direction = hull.transform.unrotate(worldDirection);
+
+		if (!hull.supportMap)
+			return maxDotIndex(hull.x, hull.y, hull.paddedSize(), direction.x, direction.y);
+
+		// start at the bucket's extreme vertex and climb to the neighbour that's further along
+		auto bucket = std::min(static_cast<size_t>(diamondAngle(direction) * hull.supportBuckets * 0.25f), hull.supportBuckets - 1);
+		size_t index = hull.supportMap[bucket];
+		float max = hull.dot(index, direction);
+
+		auto forward = [&](size_t i) { return i + 1 < hull.size ? i + 1 : 0; };
+		auto backward = [&](size_t i) { return i > 0 ? i - 1 : hull.size - 1; };
+		bool ascending = hull.dot(forward(index), direction) > max;
+
+		while (true)
+		{
+			size_t next = ascending ? forward(index) : backward(index);
+			float product = hull.dot(next, direction);
+			if (product <= max)
+				return index;
+
+			index = next;
+			max = product;
+		}
+	}
+
+	static glm::vec2 tripleProduct(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+	{
+		return b * glm::dot(a, c) - a * glm::dot(b, c);
+	}
+};
+
+struct SATPolicy
+{
+	// the axis that separated the pair last time, it's tested first
+	struct Cache
+	{
+		uint32_t axis = 0;
+		bool axisOfB = false;
+		bool separated = false;
+	};
+
+	static bool intersects(const HullView& a, const HullView& b)
+	{
+		Cache cache;
+		return intersects(a, b, cache);
+	}
+
+	static bool intersects(const HullView& a, const HullView& b, Cache& cache)
+	{
+		if (cache.separated)
+		{
+			const auto& hull = cache.axisOfB ? b : a;
+			if (cache.axis < hull.normalCount && separates(a, b, normal(hull, cache.axis)))
+				return false;
+		}
+
+		for (uint32_t i = 0; i < a.normalCount; ++i)
+			if (separates(a, b, normal(a, i)))
+			{
+				cache = { i, false, true };
+				return false;
+			}
+
+		for (uint32_t i = 0; i < b.normalCount; ++i)
+			if (separates(a, b, normal(b, i)))
+			{
+				cache = { i, true, true };
+				return false;
+			}
+
+		cache.separated = false;
+		return true;
+	}
+
+	// intersects() and clearance() in one pass over all normals, the axis of
+	// the widest gap goes to the cache
+	static bool intersects(const HullView& a, const HullView& b, Cache& cache, float& clearance)
+	{
+		clearance = 0.f;
+
+		for (bool axisOfB : { false, true })
+		{
+			const auto& hull = axisOfB ? b : a;
+			for (uint32_t i = 0; i < hull.normalCount; ++i)
+			{
+				auto axis = normal(hull, i);
+				auto [minA, maxA] = project(a, axis);
+				auto [minB, maxB] = project(b, axis);
+
+				if (auto gap = std::max(minB - maxA, minA - maxB); gap > clearance)
+				{
+					clearance = gap;
+					cache = { i, axisOfB, true };
+				}
+			}
+		}
+
+		if (clearance > 0.f)
+			return false;
+
+		cache.separated = false;
+		return true;
+	}
+
+	// Lower bound of the distance of separated hulls, the widest gap between
+	// the projections on a unit normal
+	static float clearance(const HullView& a, const HullView& b)
+	{
+		Cache cache;
+		float gap;
+		intersects(a, b, cache, gap);
+		return gap;
+	}
+
+	static bool separates(const HullView& a, const HullView& b, const glm::vec2& axis)
+	{
+		auto [minA, maxA] = project(a, axis);
+		auto [minB, maxB] = project(b, axis);
+		return maxA < minB || maxB < minA;
+	}
+
+	// the local hull is projected on the rotated axis, the translation only shifts the interval
+	static std::pair<float, float> project(const HullView& hull, const glm::vec2& axis)
+	{
+		float min, max;
+		auto local = hull.transform.unrotate(axis);
+		projectHull(hull.x, hull.y, hull.paddedSize(), local.x, local.y, min, max);
+
+		float offset = glm::dot(hull.transform.position, axis);
+		return { min + offset, max + offset };
+	}
+
+	static glm::vec2 normal(const HullView& hull, size_t i)
+	{
+		return hull.transform.rotate(hull.normals[i]);
+	}
+};
@@ -4,7 +4,7 @@
 
 #include "Level.hpp"
 #include "PolygonGen.hpp"
-#include "Collision.hpp"
+#include "CollisionDetector.hpp"
 
 
 class PerfBench : public Level
@@ -23,7 +23,10 @@ private:
 
 private:
 	sf::Window& mWindow;
-	PolygonGen mPolygons;
+	PolygonGen mPolygons; // in local space
+	std::vector<Transform> mTransforms;
+	std::vector<AABB> mLocalBounds;
+	std::vector<AABB> mBounds; // written by updatePolygons(), read by the broadphase
 	CollisionDetector mColliDetector;
 
 	std::vector<sf::ConvexShape> mShapes;
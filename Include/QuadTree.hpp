@@ -6,10 +6,19 @@
 
 class QuadTreeDetector : public BroadPhaseDetector
 {
+    static constexpr size_t NULL_INDEX = ~size_t(0);
+    static constexpr size_t TASK_MIN_OBJECTS = 256; // smaller subtrees are traversed by the task that reached them
+    static constexpr size_t TASK_CHUNK_OBJECTS = 32;
+
 public:
-    QuadTreeDetector(size_t maxNodeObjects, size_t maxDepth);
+    // incremental mode keeps the tree between frames and only moves objects that left their node,
+    // looseness > 1 enlarges node bounds by that factor (loose quadtree), at 2 any object fits
+    // into the child holding its center once the child is at least as large as the object
+    QuadTreeDetector(size_t maxNodeObjects, size_t maxDepth, bool incremental = false, float looseness = 1.f);
 
     virtual Pairs generatePairs() override;
+    virtual void queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const override;
+    virtual void traceRay(const Ray& ray, const RayVisitor& visit) const override;
     virtual void onColliderAddition() override;
 
 private:
@@ -19,32 +28,80 @@ private:
         glm::vec2 maxBound;
         CollisionID objectID;
         Object object;
+        size_t node = NULL_INDEX;
+        size_t prev = NULL_INDEX; // intrusive list of the node's objects
+        size_t next = NULL_INDEX;
         QuadTreeObject(Object object, CollisionID objectID);
-        void update();
-        bool intersects(QuadTreeObject& object);
+        void update(const AABB& bounds);
     };
 
+    // bounds of the tree objects in depth-first node order, one array per component
+    // so the overlap kernel can test a whole batch at once
+    struct NodeObjects
+    {
+        std::vector<float> minX;
+        std::vector<float> minY;
+        std::vector<float> maxX;
+        std::vector<float> maxY;
+        std::vector<CollisionID> objectIDs;
+        void resize(size_t size);
+    };
+
+    // nodes live in one pool, the four children of a node are consecutive
     struct QuadTreeNode
     {
-        QuadTreeNode(size_t depth, glm::vec2 topLeft, glm::vec2 botRight);
-        bool inBounds(QuadTreeObject& object);
-        void insert(QuadTreeObject& object);
-        void split();
-        bool isLeaf();
-        size_t getQuadrant(QuadTreeObject& object);
-        void findAllCollidingPairs(Pairs& pairs);
-        void findAllCollidingDescendants(QuadTreeObject& object, Pairs& pairs);
-        bool intersects(QuadTreeObject& object);
+        QuadTreeNode(size_t depth, glm::vec2 topLeft, glm::vec2 botRight, size_t parent, float looseness);
+        bool inBounds(const QuadTreeObject& object) const;
+        bool isLeaf() const;
+        bool isLoose() const;
+        size_t getQuadrant(const QuadTreeObject& object) const;
+        bool intersects(glm::vec2 minBound, glm::vec2 maxBound) const;
 
         size_t mDepth;
         glm::vec2 mTopLeft;
         glm::vec2 mBotRight;
         glm::vec2 mCenter;
-        std::array<std::unique_ptr<QuadTreeNode>, 4> mSubTrees;
-        std::vector<QuadTreeObject*> mQuadObjects;
+        glm::vec2 mLooseTopLeft; // same as the tight bounds unless the tree is loose
+        glm::vec2 mLooseBotRight;
+        size_t mParent;
+        size_t mFirstChild = NULL_INDEX;
+        size_t mFirstObject = NULL_INDEX;
+        size_t mCount = 0; // objects in the whole subtree
+
+        // own objects are mNodeObjects[mBegin, mEnd), descendants follow up to mSubtreeEnd
+        size_t mBegin = 0;
+        size_t mEnd = 0;
+        size_t mSubtreeEnd = 0;
     };
 
-    std::unique_ptr<QuadTreeNode> mRoot;
+    void rebuild();
+    void updateIncremental();
+
+    size_t allocateChildren(size_t node);
+    void freeChildren(size_t node);
+    bool fits(size_t node, const QuadTreeObject& object) const;
+    void insert(size_t node, size_t object);
+    void addObject(size_t node, size_t object);
+    void unlinkObject(size_t object);
+    void remove(size_t object);
+    void split(size_t node);
+    void merge(size_t node);
+    void mergeUnderfull(size_t node);
+    size_t flatten(size_t node, size_t cursor);
+    void findAllCollidingPairs(size_t node);
+    void findAllCollidingDescendants(size_t node, size_t object, Pairs& pairs);
+    void collectOverlaps(size_t object, size_t begin, size_t end, Pairs& pairs) const;
+    void findAllLoosePairs();
+
+private:
+    std::vector<QuadTreeNode> mNodes; // root is mNodes[0]
+    std::vector<size_t> mFreeChildren;
     std::vector<QuadTreeObject> mTreeObjects;
-};
+    NodeObjects mNodeObjects;
+    std::vector<Pairs> mThreadPairs;
 
+    size_t mMaxNodeObjects;
+    size_t mMaxDepth;
+    bool mIncremental;
+    float mLooseness;
+};
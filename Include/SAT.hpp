@@ -6,6 +6,7 @@
 
 #include "Visualization.hpp"
 #include "Collision.hpp"
+#include "NarrowPhase.hpp"
 
 class SAT : public NarrowPhaseDetector
 {
@@ -22,8 +23,13 @@ protected:
 		size_t maxIndex;
 	};
 
+	void setHulls(const Hull& a, const Hull& b);
 	std::vector<glm::vec2> getNormals(const Hull& hull);
-	MinMaxResult getMinMax(const Hull& hull, const glm::vec2& axis);
+	MinMaxResult getMinMax(const HullStorage& hull, const glm::vec2& axis);
+
+	// SIMD copies of the hulls, built whenever the hulls are set
+	HullStorage mStorageA;
+	HullStorage mStorageB;
 };
 
 class SATVisualizer : public Visualization, protected SAT
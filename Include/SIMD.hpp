@@ -0,0 +1,255 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SIMD_SSE2
+#endif
+
+// Boxes tested by one overlapMask call, arrays passed to it must be readable
+// (padded) for a whole batch past the last valid box.
+constexpr size_t AABB_BATCH_SIZE = 8;
+
+// Bit k of the result is set when the box (minX, minY, maxX, maxY) overlaps
+// box k of the batch. Touching boxes don't overlap, same as AABB::intersects.
+inline uint32_t overlapMask(float minX, float minY, float maxX, float maxY,
+	const float* batchMinX, const float* batchMinY, const float* batchMaxX, const float* batchMaxY)
+{
+#if defined(SIMD_AVX)
+	auto x = _mm256_and_ps(
+		_mm256_cmp_ps(_mm256_set1_ps(minX), _mm256_loadu_ps(batchMaxX), _CMP_LT_OQ),
+		_mm256_cmp_ps(_mm256_set1_ps(maxX), _mm256_loadu_ps(batchMinX), _CMP_GT_OQ));
+	auto y = _mm256_and_ps(
+		_mm256_cmp_ps(_mm256_set1_ps(minY), _mm256_loadu_ps(batchMaxY), _CMP_LT_OQ),
+		_mm256_cmp_ps(_mm256_set1_ps(maxY), _mm256_loadu_ps(batchMinY), _CMP_GT_OQ));
+
+	return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_and_ps(x, y)));
+#elif defined(SIMD_SSE2)
+	uint32_t mask = 0;
+	for (size_t i = 0; i < AABB_BATCH_SIZE; i += 4)
+	{
+		auto x = _mm_and_ps(
+			_mm_cmplt_ps(_mm_set1_ps(minX), _mm_loadu_ps(batchMaxX + i)),
+			_mm_cmpgt_ps(_mm_set1_ps(maxX), _mm_loadu_ps(batchMinX + i)));
+		auto y = _mm_and_ps(
+			_mm_cmplt_ps(_mm_set1_ps(minY), _mm_loadu_ps(batchMaxY + i)),
+			_mm_cmpgt_ps(_mm_set1_ps(maxY), _mm_loadu_ps(batchMinY + i)));
+
+		mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_and_ps(x, y))) << i;
+	}
+	return mask;
+#else
+	uint32_t mask = 0;
+	for (size_t i = 0; i < AABB_BATCH_SIZE; ++i)
+		if (minX < batchMaxX[i] && maxX > batchMinX[i] && minY < batchMaxY[i] && maxY > batchMinY[i])
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+
+// Pairwise tests over a batch of AABB_BATCH_SIZE pairs, bit k of the result
+// is set when box (or circle) k of A overlaps box (or circle) k of B.
+inline uint32_t boxPairMask(const float* minXA, const float* minYA, const float* maxXA, const float* maxYA,
+	const float* minXB, const float* minYB, const float* maxXB, const float* maxYB)
+{
+#if defined(SIMD_AVX)
+	auto x = _mm256_and_ps(
+		_mm256_cmp_ps(_mm256_loadu_ps(minXA), _mm256_loadu_ps(maxXB), _CMP_LT_OQ),
+		_mm256_cmp_ps(_mm256_loadu_ps(maxXA), _mm256_loadu_ps(minXB), _CMP_GT_OQ));
+	auto y = _mm256_and_ps(
+		_mm256_cmp_ps(_mm256_loadu_ps(minYA), _mm256_loadu_ps(maxYB), _CMP_LT_OQ),
+		_mm256_cmp_ps(_mm256_loadu_ps(maxYA), _mm256_loadu_ps(minYB), _CMP_GT_OQ));
+
+	return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_and_ps(x, y)));
+#elif defined(SIMD_SSE2)
+	uint32_t mask = 0;
+	for (size_t i = 0; i < AABB_BATCH_SIZE; i += 4)
+	{
+		auto x = _mm_and_ps(
+			_mm_cmplt_ps(_mm_loadu_ps(minXA + i), _mm_loadu_ps(maxXB + i)),
+			_mm_cmpgt_ps(_mm_loadu_ps(maxXA + i), _mm_loadu_ps(minXB + i)));
+		auto y = _mm_and_ps(
+			_mm_cmplt_ps(_mm_loadu_ps(minYA + i), _mm_loadu_ps(maxYB + i)),
+			_mm_cmpgt_ps(_mm_loadu_ps(maxYA + i), _mm_loadu_ps(minYB + i)));
+
+		mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_and_ps(x, y))) << i;
+	}
+	return mask;
+#else
+	uint32_t mask = 0;
+	for (size_t i = 0; i < AABB_BATCH_SIZE; ++i)
+		if (minXA[i] < maxXB[i] && maxXA[i] > minXB[i] && minYA[i] < maxYB[i] && maxYA[i] > minYB[i])
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+
+inline uint32_t circlePairMask(const float* xA, const float* yA, const float* radiusA,
+	const float* xB, const float* yB, const float* radiusB)
+{
+#if defined(SIMD_AVX)
+	auto dx = _mm256_sub_ps(_mm256_loadu_ps(xA), _mm256_loadu_ps(xB));
+	auto dy = _mm256_sub_ps(_mm256_loadu_ps(yA), _mm256_loadu_ps(yB));
+	auto r = _mm256_add_ps(_mm256_loadu_ps(radiusA), _mm256_loadu_ps(radiusB));
+	auto distance = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+
+	return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_mul_ps(r, r), _CMP_LT_OQ)));
+#elif defined(SIMD_SSE2)
+	uint32_t mask = 0;
+	for (size_t i = 0; i < AABB_BATCH_SIZE; i += 4)
+	{
+		auto dx = _mm_sub_ps(_mm_loadu_ps(xA + i), _mm_loadu_ps(xB + i));
+		auto dy = _mm_sub_ps(_mm_loadu_ps(yA + i), _mm_loadu_ps(yB + i));
+		auto r = _mm_add_ps(_mm_loadu_ps(radiusA + i), _mm_loadu_ps(radiusB + i));
+		auto distance = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+		mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(distance, _mm_mul_ps(r, r)))) << i;
+	}
+	return mask;
+#else
+	uint32_t mask = 0;
+	for (size_t i = 0; i < AABB_BATCH_SIZE; ++i)
+	{
+		float dx = xA[i] - xB[i];
+		float dy = yA[i] - yB[i];
+		float r = radiusA[i] + radiusB[i];
+		if (dx * dx + dy * dy < r * r)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+// Hull vertices are stored as separate x and y arrays padded to a multiple of
+// HULL_BATCH_SIZE with copies of the first vertex, so whole batches can be
+// read and the padding never changes a result.
+constexpr size_t HULL_BATCH_SIZE = 8;
+
+constexpr size_t paddedHullSize(size_t size)
+{
+	return (size + HULL_BATCH_SIZE - 1) / HULL_BATCH_SIZE * HULL_BATCH_SIZE;
+}
+
+// Index of the vertex with the largest dot(vertex, (dirX, dirY)), ties go to
+// the lowest index. count is the padded vertex count.
+inline size_t maxDotIndex(const float* x, const float* y, size_t count, float dirX, float dirY)
+{
+#if defined(SIMD_AVX)
+	// AVX1 has no 256-bit integer ops, indices are kept as floats
+	auto dx = _mm256_set1_ps(dirX);
+	auto dy = _mm256_set1_ps(dirY);
+	auto index = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+	auto step = _mm256_set1_ps(8.f);
+	auto best = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x), dx), _mm256_mul_ps(_mm256_loadu_ps(y), dy));
+	auto bestIndex = index;
+
+	for (size_t i = 8; i < count; i += 8)
+	{
+		index = _mm256_add_ps(index, step);
+		auto d = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x + i), dx), _mm256_mul_ps(_mm256_loadu_ps(y + i), dy));
+		auto greater = _mm256_cmp_ps(d, best, _CMP_GT_OQ);
+		best = _mm256_blendv_ps(best, d, greater);
+		bestIndex = _mm256_blendv_ps(bestIndex, index, greater);
+	}
+
+	alignas(32) float values[8];
+	alignas(32) float indices[8];
+	_mm256_store_ps(values, best);
+	_mm256_store_ps(indices, bestIndex);
+	constexpr size_t lanes = 8;
+#elif defined(SIMD_SSE2)
+	auto dx = _mm_set1_ps(dirX);
+	auto dy = _mm_set1_ps(dirY);
+	auto index = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+	auto step = _mm_set1_ps(4.f);
+	auto best = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x), dx), _mm_mul_ps(_mm_loadu_ps(y), dy));
+	auto bestIndex = index;
+
+	for (size_t i = 4; i < count; i += 4)
+	{
+		index = _mm_add_ps(index, step);
+		auto d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), dx), _mm_mul_ps(_mm_loadu_ps(y + i), dy));
+		auto greater = _mm_cmpgt_ps(d, best);
+		best = _mm_or_ps(_mm_and_ps(greater, d), _mm_andnot_ps(greater, best));
+		bestIndex = _mm_or_ps(_mm_and_ps(greater, index), _mm_andnot_ps(greater, bestIndex));
+	}
+
+	alignas(16) float values[4];
+	alignas(16) float indices[4];
+	_mm_store_ps(values, best);
+	_mm_store_ps(indices, bestIndex);
+	constexpr size_t lanes = 4;
+#else
+	float values[1] = { x[0] * dirX + y[0] * dirY };
+	float indices[1] = { 0.f };
+	for (size_t i = 1; i < count; ++i)
+		if (float d = x[i] * dirX + y[i] * dirY; d > values[0])
+		{
+			values[0] = d;
+			indices[0] = static_cast<float>(i);
+		}
+	constexpr size_t lanes = 1;
+#endif
+
+	size_t lane = 0;
+	for (size_t i = 1; i < lanes; ++i)
+		if (values[i] > values[lane] || (values[i] == values[lane] && indices[i] < indices[lane]))
+			lane = i;
+
+	return static_cast<size_t>(indices[lane]);
+}
+
+// Smallest and largest dot(vertex, (axisX, axisY)) of the hull, count is the
+// padded vertex count.
+inline void projectHull(const float* x, const float* y, size_t count, float axisX, float axisY, float& min, float& max)
+{
+#if defined(SIMD_AVX)
+	auto ax = _mm256_set1_ps(axisX);
+	auto ay = _mm256_set1_ps(axisY);
+	auto lo = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x), ax), _mm256_mul_ps(_mm256_loadu_ps(y), ay));
+	auto hi = lo;
+
+	for (size_t i = 8; i < count; i += 8)
+	{
+		auto d = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x + i), ax), _mm256_mul_ps(_mm256_loadu_ps(y + i), ay));
+		lo = _mm256_min_ps(lo, d);
+		hi = _mm256_max_ps(hi, d);
+	}
+
+	auto lo4 = _mm_min_ps(_mm256_castps256_ps128(lo), _mm256_extractf128_ps(lo, 1));
+	auto hi4 = _mm_max_ps(_mm256_castps256_ps128(hi), _mm256_extractf128_ps(hi, 1));
+#elif defined(SIMD_SSE2)
+	auto ax = _mm_set1_ps(axisX);
+	auto ay = _mm_set1_ps(axisY);
+	auto lo4 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x), ax), _mm_mul_ps(_mm_loadu_ps(y), ay));
+	auto hi4 = lo4;
+
+	for (size_t i = 4; i < count; i += 4)
+	{
+		auto d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), ax), _mm_mul_ps(_mm_loadu_ps(y + i), ay));
+		lo4 = _mm_min_ps(lo4, d);
+		hi4 = _mm_max_ps(hi4, d);
+	}
+#else
+	min = max = x[0] * axisX + y[0] * axisY;
+	for (size_t i = 1; i < count; ++i)
+	{
+		float d = x[i] * axisX + y[i] * axisY;
+		min = d < min ? d : min;
+		max = d > max ? d : max;
+	}
+#endif
+
+#if defined(SIMD_AVX) || defined(SIMD_SSE2)
+	lo4 = _mm_min_ps(lo4, _mm_shuffle_ps(lo4, lo4, _MM_SHUFFLE(1, 0, 3, 2)));
+	lo4 = _mm_min_ps(lo4, _mm_shuffle_ps(lo4, lo4, _MM_SHUFFLE(2, 3, 0, 1)));
+	hi4 = _mm_max_ps(hi4, _mm_shuffle_ps(hi4, hi4, _MM_SHUFFLE(1, 0, 3, 2)));
+	hi4 = _mm_max_ps(hi4, _mm_shuffle_ps(hi4, hi4, _MM_SHUFFLE(2, 3, 0, 1)));
+	min = _mm_cvtss_f32(lo4);
+	max = _mm_cvtss_f32(hi4);
+#endif
+}
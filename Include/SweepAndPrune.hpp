@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Collision.hpp"
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Sort and prune along both axes. Endpoint order and the overlapping pairs are
+// kept between frames, the insertion sort updates the pairs from the endpoints
+// it swaps, so slowly moving objects cost O(N + swaps). Added colliders make
+// the next frame sort and sweep from scratch.
+class SweepAndPrune : public BroadPhaseDetector
+{
+	static constexpr size_t NOT_ACTIVE = ~size_t(0);
+	static constexpr size_t CLOSED = NOT_ACTIVE - 1; // max endpoint passed before the min one
+
+public:
+	SweepAndPrune() = default;
+
+	virtual Pairs generatePairs() override;
+	virtual void queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const override;
+
+private:
+	virtual void onColliderAddition() override;
+	void rebuild();
+	void sortAxis(size_t axis);
+	void addPair(CollisionID a, CollisionID b);
+	void removePair(CollisionID a, CollisionID b);
+	static uint64_t pairKey(CollisionID a, CollisionID b) { return (uint64_t(a) << 32) | uint64_t(b); }
+
+private:
+	struct Endpoint
+	{
+		float value;
+		CollisionID objectID;
+		bool isMin;
+
+		bool operator<(const Endpoint& other) const
+		{
+			// on ties close the interval first, touching boxes don't intersect
+			return value < other.value || (value == other.value && isMin < other.isMin);
+		}
+	};
+
+	std::array<std::vector<Endpoint>, 2> mEndpoints; // per axis
+	std::vector<CollisionID> mActive;
+	std::vector<size_t> mActiveIndex; // position in mActive, NOT_ACTIVE or CLOSED
+	float mMaxWidth = 0.f; // widest interval on X, bounds how far left of a query the overlaps can start
+	bool mRebuild = false;
+
+	Pairs mPairs; // smaller id first
+	std::unordered_map<uint64_t, size_t> mPairIndex; // position in mPairs
+};
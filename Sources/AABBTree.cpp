@@ -0,0 +1,346 @@
+#include "AABBTree.hpp"
+
+using namespace glm;
+
+namespace
+{
+	float perimeter(const AABB& bounds)
+	{
+		auto size = bounds.max - bounds.min;
+		return 2.f * (size.x + size.y);
+	}
+}
+
+AABBTreeDetector::AABBTreeDetector(float margin, float velocityScale)
+	: mMargin(margin)
+	, mVelocityScale(velocityScale)
+{
+}
+
+Pairs AABBTreeDetector::generatePairs()
+{
+	updateBounds();
+
+	// reinsert only the objects which escaped their fat bounds
+	for (CollisionID i = 0; i < mObjects.size(); ++i)
+	{
+		// the first position only seeds the motion, the bounds at addition may predate the transforms
+		auto displacement = mTracked[i] ? mBounds[i].min - mLastPositions[i] : vec2(0.f);
+		mLastPositions[i] = mBounds[i].min;
+		mTracked[i] = true;
+
+		auto leaf = mLeaves[i];
+		if (mNodes[leaf].bounds.contains(mBounds[i]))
+			continue;
+
+		removeLeaf(leaf);
+		mNodes[leaf].bounds = fatten(mBounds[i], displacement);
+		insertLeaf(leaf);
+	}
+
+	Pairs pairs;
+
+	#pragma omp parallel
+	{
+		Pairs localPairs;
+		std::vector<size_t> stack;
+
+		#pragma omp for schedule(dynamic, 64) nowait
+		for (CollisionID i = 0; i < mObjects.size(); ++i)
+		{
+			const auto& bound = mBounds[i];
+			stack.clear();
+			stack.emplace_back(mRoot);
+
+			while (!stack.empty())
+			{
+				const auto& node = mNodes[stack.back()];
+				stack.pop_back();
+
+				if (!node.bounds.intersects(bound))
+					continue;
+
+				if (!node.isLeaf())
+				{
+					stack.emplace_back(node.children[0]);
+					stack.emplace_back(node.children[1]);
+				}
+				else if (node.objectID > i && bound.intersects(mBounds[node.objectID]))
+					localPairs.emplace_back(i, node.objectID);
+			}
+		}
+
+		#pragma omp critical (pairs)
+		pairs.insert(pairs.end(), localPairs.begin(), localPairs.end());
+	}
+
+	return pairs;
+}
+
+void AABBTreeDetector::queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const
+{
+	if (mRoot == NULL_NODE)
+		return;
+
+	std::vector<size_t> stack(1, mRoot);
+
+	while (!stack.empty())
+	{
+		const auto& node = mNodes[stack.back()];
+		stack.pop_back();
+
+		if (!node.bounds.intersects(region))
+			continue;
+
+		if (node.isLeaf())
+		{
+			if (mBounds[node.objectID].intersects(region))
+				candidates.emplace_back(node.objectID);
+		}
+		else
+		{
+			stack.emplace_back(node.children[0]);
+			stack.emplace_back(node.children[1]);
+		}
+	}
+}
+
+void AABBTreeDetector::traceRay(const Ray& ray, const RayVisitor& visit) const
+{
+	if (mRoot == NULL_NODE)
+		return;
+
+	// nodes with the fraction the ray enters them, the nearer child is popped first
+	float limit = 1.f;
+	std::vector<std::pair<size_t, float>> stack;
+	if (auto enter = ray.enters(mNodes[mRoot].bounds))
+		stack.emplace_back(mRoot, *enter);
+
+	while (!stack.empty())
+	{
+		auto [index, enter] = stack.back();
+		stack.pop_back();
+
+		if (enter >= limit)
+			continue;
+
+		const auto& node = mNodes[index];
+		if (node.isLeaf())
+		{
+			if (ray.enters(mBounds[node.objectID], limit))
+				limit = visit(node.objectID);
+			continue;
+		}
+
+		auto children = node.children;
+		std::optional<float> enters[2] = { ray.enters(mNodes[children[0]].bounds, limit), ray.enters(mNodes[children[1]].bounds, limit) };
+		if (enters[0] < enters[1])
+		{
+			std::swap(children[0], children[1]);
+			std::swap(enters[0], enters[1]);
+		}
+
+		for (size_t c = 0; c < 2; ++c)
+			if (enters[c])
+				stack.emplace_back(children[c], *enters[c]);
+	}
+}
+
+void AABBTreeDetector::onColliderAddition()
+{
+	CollisionID id = mObjects.size() - 1;
+	auto bounds = computeBounds(id);
+
+	auto leaf = allocateNode();
+	mNodes[leaf].objectID = id;
+	mNodes[leaf].bounds = fatten(bounds, vec2(0.f));
+	insertLeaf(leaf);
+
+	mLeaves.emplace_back(leaf);
+	mLastPositions.emplace_back(bounds.min);
+	mTracked.push_back(false);
+}
+
+size_t AABBTreeDetector::allocateNode()
+{
+	if (mFreeList == NULL_NODE)
+	{
+		mNodes.emplace_back();
+		return mNodes.size() - 1;
+	}
+
+	auto node = mFreeList;
+	mFreeList = mNodes[node].parent;
+	mNodes[node] = Node();
+	return node;
+}
+
+void AABBTreeDetector::freeNode(size_t node)
+{
+	mNodes[node].parent = mFreeList;
+	mFreeList = node;
+}
+
+void AABBTreeDetector::insertLeaf(size_t leaf)
+{
+	if (mRoot == NULL_NODE)
+	{
+		mRoot = leaf;
+		mNodes[leaf].parent = NULL_NODE;
+		return;
+	}
+
+	// descend by the surface area heuristic (perimeter in 2D)
+	auto leafBounds = mNodes[leaf].bounds;
+	auto index = mRoot;
+	while (!mNodes[index].isLeaf())
+	{
+		const auto& node = mNodes[index];
+		auto combinedPerimeter = perimeter(node.bounds.merge(leafBounds));
+		auto cost = 2.f * combinedPerimeter;
+		auto inheritanceCost = 2.f * (combinedPerimeter - perimeter(node.bounds));
+
+		float childCost[2];
+		for (size_t c = 0; c < 2; ++c)
+		{
+			const auto& child = mNodes[node.children[c]];
+			childCost[c] = perimeter(child.bounds.merge(leafBounds)) + inheritanceCost;
+			if (!child.isLeaf())
+				childCost[c] -= perimeter(child.bounds);
+		}
+
+		if (cost < childCost[0] && cost < childCost[1])
+			break;
+
+		index = childCost[0] < childCost[1] ? node.children[0] : node.children[1];
+	}
+
+	auto sibling = index;
+	auto oldParent = mNodes[sibling].parent;
+	auto newParent = allocateNode();
+
+	mNodes[newParent].parent = oldParent;
+	mNodes[newParent].bounds = mNodes[sibling].bounds.merge(leafBounds);
+	mNodes[newParent].height = mNodes[sibling].height + 1;
+	mNodes[newParent].children = { sibling, leaf };
+	mNodes[sibling].parent = newParent;
+	mNodes[leaf].parent = newParent;
+
+	if (oldParent == NULL_NODE)
+		mRoot = newParent;
+	else
+	{
+		auto& children = mNodes[oldParent].children;
+		children[children[0] == sibling ? 0 : 1] = newParent;
+	}
+
+	refit(newParent);
+}
+
+void AABBTreeDetector::removeLeaf(size_t leaf)
+{
+	if (leaf == mRoot)
+	{
+		mRoot = NULL_NODE;
+		return;
+	}
+
+	auto parent = mNodes[leaf].parent;
+	auto grandParent = mNodes[parent].parent;
+	const auto& children = mNodes[parent].children;
+	auto sibling = children[0] == leaf ? children[1] : children[0];
+
+	freeNode(parent);
+	mNodes[sibling].parent = grandParent;
+
+	if (grandParent == NULL_NODE)
+	{
+		mRoot = sibling;
+		return;
+	}
+
+	auto& grandChildren = mNodes[grandParent].children;
+	grandChildren[grandChildren[0] == parent ? 0 : 1] = sibling;
+	refit(grandParent);
+}
+
+void AABBTreeDetector::refit(size_t node)
+{
+	// walk to the root fixing bounds and heights, rotating where unbalanced
+	while (node != NULL_NODE)
+	{
+		node = balance(node);
+
+		auto& n = mNodes[node];
+		const auto& a = mNodes[n.children[0]];
+		const auto& b = mNodes[n.children[1]];
+		n.height = 1 + std::max(a.height, b.height);
+		n.bounds = a.bounds.merge(b.bounds);
+
+		node = n.parent;
+	}
+}
+
+size_t AABBTreeDetector::balance(size_t iA)
+{
+	auto& A = mNodes[iA];
+	if (A.isLeaf() || A.height < 2)
+		return iA;
+
+	// rotates the taller child up, its taller grandchild stays with it
+	auto rotate = [&](size_t up)
+	{
+		auto iUp = A.children[up];
+		auto iOther = A.children[1 - up];
+		auto& U = mNodes[iUp];
+		auto iF = U.children[0];
+		auto iG = U.children[1];
+
+		U.children[0] = iA;
+		U.parent = A.parent;
+		A.parent = iUp;
+
+		if (U.parent == NULL_NODE)
+			mRoot = iUp;
+		else
+		{
+			auto& children = mNodes[U.parent].children;
+			children[children[0] == iA ? 0 : 1] = iUp;
+		}
+
+		if (mNodes[iF].height < mNodes[iG].height)
+			std::swap(iF, iG);
+
+		// F is the taller grandchild and stays under U, G moves down to A
+		U.children[1] = iF;
+		A.children[up] = iG;
+		mNodes[iG].parent = iA;
+
+		A.bounds = mNodes[iOther].bounds.merge(mNodes[iG].bounds);
+		A.height = 1 + std::max(mNodes[iOther].height, mNodes[iG].height);
+		U.bounds = A.bounds.merge(mNodes[iF].bounds);
+		U.height = 1 + std::max(A.height, mNodes[iF].height);
+
+		return iUp;
+	};
+
+	auto heightDiff = mNodes[A.children[1]].height - mNodes[A.children[0]].height;
+	if (heightDiff > 1)
+		return rotate(1);
+	if (heightDiff < -1)
+		return rotate(0);
+
+	return iA;
+}
+
+AABB AABBTreeDetector::fatten(const AABB& bounds, vec2 displacement) const
+{
+	AABB fat(bounds.min - mMargin, bounds.max + mMargin);
+
+	// extend along the motion, so a steadily moving object stays inside longer
+	auto predicted = displacement * mVelocityScale;
+	fat.min += glm::min(predicted, vec2(0.f));
+	fat.max += glm::max(predicted, vec2(0.f));
+
+	return fat;
+}
@@ -0,0 +1,201 @@
+#include "BroadPhaseTuner.hpp"
+#include "Constants.hpp"
+#include "QuadTree.hpp"
+#include "SweepAndPrune.hpp"
+#include "LBVH.hpp"
+#include "HierarchicalGrid.hpp"
+#include "AABBTree.hpp"
+#include <chrono>
+#include <cmath>
+
+using namespace glm;
+
+Pairs BroadPhaseTuner::generatePairs()
+{
+	if (mCandidates.empty() || mRetune)
+	{
+		updateBounds();
+		makeCandidates(measure(mBounds));
+	}
+	else if (!mTuning && mCandidates.size() > 1)
+	{
+		// tuning finished last frame, the losers aren't needed anymore
+		std::swap(mCandidates[mCurrent], mCandidates.front());
+		mCandidates.resize(1);
+		mCurrent = 0;
+	}
+
+	auto& candidate = mCandidates[mCurrent];
+	mLastRun = candidate.detector.get();
+
+	auto start = std::chrono::steady_clock::now();
+	auto pairs = candidate.detector->generatePairs();
+	double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (mTuning)
+	{
+		if (mTrialFrame > 0)
+			candidate.bestTime = std::min(candidate.bestTime, time);
+
+		if (++mTrialFrame == TRIAL_FRAMES)
+		{
+			mTrialFrame = 0;
+			if (++mCurrent == mCandidates.size())
+				selectFastest();
+		}
+
+		return pairs;
+	}
+
+	mAverageTime = mAverageTime * 0.9 + time * 0.1;
+
+	if (++mSampleFrame == SAMPLE_INTERVAL)
+	{
+		mSampleFrame = 0;
+
+		// candidates are rebuilt from the new scene on the next frame
+		mRetune = hasChanged(measure(candidate.detector->getBounds())) || mAverageTime > mTunedTime * SLOWDOWN_RATIO;
+	}
+
+	return pairs;
+}
+
+const std::vector<AABB>& BroadPhaseTuner::getBounds() const
+{
+	return mLastRun ? mLastRun->getBounds() : mBounds;
+}
+
+void BroadPhaseTuner::queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const
+{
+	if (mLastRun)
+		mLastRun->queryBounds(region, candidates);
+	else
+		BroadPhaseDetector::queryBounds(region, candidates);
+}
+
+void BroadPhaseTuner::traceRay(const Ray& ray, const RayVisitor& visit) const
+{
+	if (mLastRun)
+		mLastRun->traceRay(ray, visit);
+	else
+		BroadPhaseDetector::traceRay(ray, visit);
+}
+
+void BroadPhaseTuner::setTransforms(std::span<const Transform> transforms)
+{
+	mTransforms = transforms;
+	for (auto& c : mCandidates)
+		c.detector->setTransforms(transforms);
+}
+
+void BroadPhaseTuner::setBounds(std::span<const AABB> bounds)
+{
+	mSuppliedBounds = bounds;
+	for (auto& c : mCandidates)
+		c.detector->setBounds(bounds);
+}
+
+void BroadPhaseTuner::onColliderAddition()
+{
+	for (auto& c : mCandidates)
+		c.detector->addCollider(mObjects.back());
+}
+
+BroadPhaseTuner::SceneStats BroadPhaseTuner::measure(const std::vector<AABB>& bounds)
+{
+	SceneStats stats;
+	stats.objectCount = bounds.size();
+
+	if (bounds.empty())
+		return stats;
+
+	double extent = 0.0;
+	double area = 0.0;
+	float minX = std::numeric_limits<float>::max(), minY = minX;
+	float maxX = std::numeric_limits<float>::lowest(), maxY = maxX;
+
+	#pragma omp parallel for schedule(static) reduction(+:extent, area) reduction(min:minX, minY) reduction(max:maxX, maxY)
+	for (CollisionID i = 0; i < bounds.size(); ++i)
+	{
+		auto size = bounds[i].max - bounds[i].min;
+		extent += std::max(size.x, size.y);
+		area += size.x * size.y;
+		minX = std::min(minX, bounds[i].min.x);
+		minY = std::min(minY, bounds[i].min.y);
+		maxX = std::max(maxX, bounds[i].max.x);
+		maxY = std::max(maxY, bounds[i].max.y);
+	}
+
+	stats.meanExtent = static_cast<float>(extent / bounds.size());
+	stats.density = static_cast<float>(area / std::max((maxX - minX) * (maxY - minY), 1.f));
+
+	return stats;
+}
+
+bool BroadPhaseTuner::hasChanged(const SceneStats& stats) const
+{
+	auto differs = [](double a, double b)
+	{
+		return std::max(a, b) > std::min(a, b) * RETUNE_RATIO + 1e-6;
+	};
+
+	return differs(static_cast<double>(stats.objectCount), static_cast<double>(mTunedStats.objectCount))
+		|| differs(stats.meanExtent, mTunedStats.meanExtent)
+		|| differs(stats.density, mTunedStats.density);
+}
+
+void BroadPhaseTuner::makeCandidates(const SceneStats& stats)
+{
+	mCandidates.clear();
+	mCurrent = 0;
+	mTrialFrame = 0;
+	mTuning = true;
+	mRetune = false;
+	mTunedStats = stats;
+
+	// grid cells of about two object extents, but no more cells than a few per object
+	float extent = std::max(stats.meanExtent, 1.f);
+	float minCellSize = std::sqrt(AREA_SIZE.x * AREA_SIZE.y * 4.f / std::max<float>(stats.objectCount * 4.f, 1.f));
+	for (float scale : { 2.f, 4.f })
+	{
+		auto cellSize = static_cast<size_t>(std::max(extent * scale, minCellSize));
+		addCandidate("grid(" + std::to_string(cellSize) + ")", std::make_unique<SpatialGrid>(cellSize));
+	}
+
+	// quadtree leaves shouldn't get much smaller than the objects
+	auto depth = static_cast<size_t>(std::clamp(std::log2(AREA_SIZE.x * 2.f / extent), 2.f, 12.f));
+	for (size_t maxNodeObjects : { 8, 16 })
+		addCandidate("quadtree(" + std::to_string(maxNodeObjects) + ", " + std::to_string(depth) + ", loose)",
+			std::make_unique<QuadTreeDetector>(maxNodeObjects, depth, true, 2.f));
+	addCandidate("quadtree(10, " + std::to_string(depth) + ")", std::make_unique<QuadTreeDetector>(10, depth, true));
+
+	addCandidate("sap", std::make_unique<SweepAndPrune>());
+	addCandidate("lbvh", std::make_unique<LBVHDetector>());
+	addCandidate("hgrid(" + std::to_string(static_cast<int>(extent)) + ")", std::make_unique<HierarchicalGrid>(extent));
+	addCandidate("aabbtree(" + std::to_string(static_cast<int>(extent * 0.25f)) + ")", std::make_unique<AABBTreeDetector>(extent * 0.25f));
+}
+
+void BroadPhaseTuner::addCandidate(std::string name, std::unique_ptr<BroadPhaseDetector>&& detector)
+{
+	detector->setTransforms(mTransforms);
+	detector->setBounds(mSuppliedBounds);
+	for (auto& object : mObjects)
+		detector->addCollider(object);
+
+	mCandidates.push_back({ std::move(name), std::move(detector), std::numeric_limits<double>::max() });
+}
+
+void BroadPhaseTuner::selectFastest()
+{
+	auto fastest = std::min_element(mCandidates.begin(), mCandidates.end(), [](const Candidate& a, const Candidate& b)
+	{
+		return a.bestTime < b.bestTime;
+	});
+
+	// the others are dropped next frame, the caller may still read the bounds of the last trial
+	mCurrent = fastest - mCandidates.begin();
+	mTuning = false;
+	mTunedTime = fastest->bestTime;
+	mAverageTime = mTunedTime;
+	mSampleFrame = 0;
+}
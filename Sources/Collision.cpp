@@ -1,97 +1,420 @@
 ﻿#include "Collision.hpp"
 #include "Constants.hpp"
-#include "GJK.hpp"
+#include "NarrowPhase.hpp"
 
-#include <set>
+#include <algorithm>
+#include <limits>
 
 
 using namespace glm;
 
+AABB::AABB(const Object& object)
+	: min(std::numeric_limits<float>::max())
+	, max(std::numeric_limits<float>::lowest())
+{
+	for (const auto& v : object)
+	{
+		min = glm::min(min, v);
+		max = glm::max(max, v);
+	}
+}
+
+void BroadPhaseDetector::updateBounds()
+{
+	mBounds.resize(mObjects.size());
+
+	if (mSuppliedBounds.size() >= mObjects.size())
+	{
+		std::copy_n(mSuppliedBounds.begin(), mObjects.size(), mBounds.begin());
+		return;
+	}
+
+	#pragma omp parallel for schedule(static)
+	for (CollisionID i = 0; i < mObjects.size(); ++i)
+		mBounds[i] = computeBounds(i);
+}
+
+AABB BroadPhaseDetector::computeBounds(CollisionID id) const
+{
+	if (id >= mTransforms.size())
+		return AABB(mObjects[id]);
+
+	// translated bounds stay exact, only rotated objects are scanned
+	const auto& transform = mTransforms[id];
+	if (!transform.isRotated())
+		return { mLocalBounds[id].min + transform.position, mLocalBounds[id].max + transform.position };
+
+	AABB bounds(vec2(std::numeric_limits<float>::max()), vec2(std::numeric_limits<float>::lowest()));
+	for (const auto& v : mObjects[id])
+	{
+		auto p = transform.apply(v);
+		bounds.min = glm::min(bounds.min, p);
+		bounds.max = glm::max(bounds.max, p);
+	}
+
+	return bounds;
+}
+
+void BroadPhaseDetector::queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const
+{
+	const auto& bounds = getBounds();
+	for (CollisionID i = 0; i < bounds.size(); ++i)
+		if (bounds[i].intersects(region))
+			candidates.emplace_back(i);
+}
+
+void BroadPhaseDetector::traceRay(const Ray& ray, const RayVisitor& visit) const
+{
+	std::vector<CollisionID> candidates;
+	auto end = ray.origin + ray.direction;
+	queryBounds({ glm::min(ray.origin, end), glm::max(ray.origin, end) }, candidates);
+
+	const auto& bounds = getBounds();
+	float limit = 1.f;
+	for (auto id : candidates)
+		if (ray.enters(bounds[id], limit))
+			limit = visit(id);
+}
+
+std::vector<CollisionID> BroadPhaseDetector::queryPoint(vec2 point) const
+{
+	std::vector<CollisionID> candidates, hits;
+	collectPoint(point, candidates, hits);
+	return hits;
+}
+
+std::vector<CollisionID> BroadPhaseDetector::queryRegion(const AABB& region) const
+{
+	std::vector<CollisionID> candidates, hits;
+	collectRegion(region, candidates, hits);
+	return hits;
+}
+
+std::vector<RayHit> BroadPhaseDetector::queryRay(const Ray& ray) const
+{
+	std::vector<RayHit> hits;
+	collectRay(ray, hits);
+
+	std::sort(hits.begin(), hits.end(), [](const RayHit& a, const RayHit& b) { return a.fraction < b.fraction; });
+	return hits;
+}
+
+QueryResults BroadPhaseDetector::queryPoints(std::span<const vec2> points) const
+{
+	return runQueries(points.size(), [&](size_t i, std::vector<CollisionID>& candidates, std::vector<CollisionID>& hits)
+	{
+		collectPoint(points[i], candidates, hits);
+	});
+}
+
+QueryResults BroadPhaseDetector::queryRegions(std::span<const AABB> regions) const
+{
+	return runQueries(regions.size(), [&](size_t i, std::vector<CollisionID>& candidates, std::vector<CollisionID>& hits)
+	{
+		collectRegion(regions[i], candidates, hits);
+	});
+}
+
+std::vector<std::optional<RayHit>> BroadPhaseDetector::queryRays(std::span<const Ray> rays) const
+{
+	std::vector<std::optional<RayHit>> closest(rays.size());
+
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		// the ray is cut at the closest hit so far
+		float limit = 1.f;
+		auto visit = [&](CollisionID id)
+		{
+			auto fraction = castRay(id, rays[i]);
+			if (fraction && *fraction < limit)
+			{
+				closest[i] = RayHit{ id, *fraction };
+				limit = *fraction;
+			}
+			return limit;
+		};
+
+		traceRay(rays[i], visit);
+	}
+
+	return closest;
+}
+
+void BroadPhaseDetector::collectPoint(vec2 point, std::vector<CollisionID>& candidates, std::vector<CollisionID>& hits) const
+{
+	candidates.clear();
+	queryBounds({ point, point }, candidates);
+
+	for (auto id : candidates)
+		if (containsPoint(id, point))
+			hits.emplace_back(id);
+}
+
+void BroadPhaseDetector::collectRegion(const AABB& region, std::vector<CollisionID>& candidates, std::vector<CollisionID>& hits) const
+{
+	candidates.clear();
+	queryBounds(region, candidates);
+
+	for (auto id : candidates)
+		if (overlapsRegion(id, region))
+			hits.emplace_back(id);
+}
+
+void BroadPhaseDetector::collectRay(const Ray& ray, std::vector<RayHit>& hits) const
+{
+	auto visit = [&](CollisionID id)
+	{
+		if (auto fraction = castRay(id, ray))
+			hits.push_back({ id, *fraction });
+		return 1.f;
+	};
+
+	traceRay(ray, visit);
+}
+
+bool BroadPhaseDetector::containsPoint(CollisionID id, vec2 point) const
+{
+	const auto& object = mObjects[id];
+	if (id < mTransforms.size())
+		point = mTransforms[id].unrotate(point - mTransforms[id].position);
+
+	// strictly on the inner side of every edge, for either winding
+	bool left = true, right = true;
+	for (size_t i = 0; i < object.size(); ++i)
+	{
+		auto edge = object[(i + 1) % object.size()] - object[i];
+		if (edge == vec2(0.f))
+			continue;
+
+		auto offset = point - object[i];
+		auto cross = edge.x * offset.y - edge.y * offset.x;
+		left &= cross > 0.f;
+		right &= cross < 0.f;
+	}
+
+	return left || right;
+}
+
+bool BroadPhaseDetector::overlapsRegion(CollisionID id, const AABB& region) const
+{
+	// SAT between the region's box and the object, copied to the layout of the kernels
+	thread_local std::vector<float> x, y;
+	thread_local std::vector<vec2> normals;
+
+	const auto& object = mObjects[id];
+	x.resize(paddedHullSize(object.size()));
+	y.resize(paddedHullSize(object.size()));
+	normals.resize(object.size());
+	storeHull(object, x.data(), y.data());
+
+	HullView hull = { x.data(), y.data(), object.size(), nullptr, 0, normals.data(), buildHullNormals(object, normals.data()) };
+	if (id < mTransforms.size())
+		hull.transform = mTransforms[id];
+
+	float boxX[paddedHullSize(4)] = { region.min.x, region.max.x, region.max.x, region.min.x };
+	float boxY[paddedHullSize(4)] = { region.min.y, region.min.y, region.max.y, region.max.y };
+	const vec2 boxNormals[] = { { 1.f, 0.f }, { 0.f, 1.f } };
+	std::fill(boxX + 4, std::end(boxX), boxX[0]);
+	std::fill(boxY + 4, std::end(boxY), boxY[0]);
+
+	return SATPolicy::intersects({ boxX, boxY, 4, nullptr, 0, boxNormals, 2 }, hull);
+}
+
+std::optional<float> BroadPhaseDetector::castRay(CollisionID id, const Ray& ray) const
+{
+	auto origin = ray.origin;
+	auto direction = ray.direction;
+	if (id < mTransforms.size())
+	{
+		origin = mTransforms[id].unrotate(origin - mTransforms[id].position);
+		direction = mTransforms[id].unrotate(direction);
+	}
+
+	const auto& object = mObjects[id];
+	float winding = 0.f;
+	for (size_t i = 0; i < object.size(); ++i)
+	{
+		const auto& a = object[i];
+		const auto& b = object[(i + 1) % object.size()];
+		winding += a.x * b.y - a.y * b.x;
+	}
+
+	if (winding == 0.f)
+		return std::nullopt;
+
+	// Cyrus-Beck, the ray is clipped by the half plane of every edge
+	float enter = 0.f, exit = 1.f;
+	for (size_t i = 0; i < object.size(); ++i)
+	{
+		auto edge = object[(i + 1) % object.size()] - object[i];
+		if (edge == vec2(0.f))
+			continue;
+
+		vec2 normal = winding > 0.f ? vec2(edge.y, -edge.x) : vec2(-edge.y, edge.x); // outward
+		auto distance = dot(normal, origin - object[i]);
+		auto speed = dot(normal, direction);
+
+		if (speed == 0.f)
+		{
+			if (distance >= 0.f)
+				return std::nullopt;
+			continue;
+		}
+
+		auto t = -distance / speed;
+		if (speed < 0.f)
+			enter = std::max(enter, t);
+		else
+			exit = std::min(exit, t);
+
+		if (enter >= exit)
+			return std::nullopt;
+	}
+
+	return enter;
+}
+
 SpatialGrid::SpatialGrid(size_t gridSize)
 	: mGridSize(gridSize)
 {
 	mGridSpan = (static_cast<uvec2>(AREA_SIZE) * 2u) / static_cast<unsigned>(mGridSize) + 2u; // TODO check without +1
-	mBins.resize(mGridSpan.x * mGridSpan.y);
+	mCellStart.resize(mGridSpan.x * mGridSpan.y + 1);
+	mCellCursor.resize(mGridSpan.x * mGridSpan.y);
 }
 
 Pairs SpatialGrid::generatePairs()
 {
 	makeBins();
 
-	Pairs pairs; // TODO maybe reserve smth
-	for (const auto& bin : mBins)
-		for (size_t i = 0; i < bin.size(); ++i)
-			for (size_t j = i + 1; j < bin.size(); ++j)
-				pairs.emplace_back(bin[i], bin[j]);
-	
+	Pairs pairs;
+
+	#pragma omp parallel
+	{
+		Pairs localPairs;
+
+		#pragma omp for schedule(dynamic, 16) nowait
+		for (size_t cell = 0; cell < mCellCursor.size(); ++cell)
+		{
+			auto cellPos = uvec2(cell % mGridSpan.x, cell / mGridSpan.x);
+
+			for (size_t i = mCellStart[cell]; i < mCellStart[cell + 1]; ++i)
+			{
+				for (size_t j = i + 1; j < mCellStart[cell + 1]; ++j)
+				{
+					auto a = mCellObjects[i];
+					auto b = mCellObjects[j];
+
+					// objects sharing several cells are reported only by the first shared one
+					uvec2 firstShared = glm::max(mCellRanges[a].min, mCellRanges[b].min);
+					if (firstShared == cellPos)
+						localPairs.emplace_back(a, b);
+				}
+			}
+		}
+
+		#pragma omp critical (pairs)
+		pairs.insert(pairs.end(), localPairs.begin(), localPairs.end());
+	}
+
 	return pairs;
 }
 
 void SpatialGrid::makeBins()
 {
-	for (auto& b : mBins)
-		b.clear();
-	
-	#pragma omp parallel for shared(mBins)
+	updateBounds();
+	mCellRanges.resize(mObjects.size());
+	std::fill(mCellStart.begin(), mCellStart.end(), 0);
+
+	// count pass, objects are binned by the cell range of their AABB
+	#pragma omp parallel for schedule(static)
 	for (CollisionID i = 0; i < mObjects.size(); ++i)
 	{
-		std::set<size_t> binSet;
-		for (const auto& v : mObjects[i])
-		{
-			uvec2 gridpos = static_cast<uvec2>(v + AREA_SIZE + float(mGridSize / 2)) / static_cast<unsigned>(mGridSize);
-			binSet.emplace(gridpos.x + gridpos.y * mGridSpan.x);
-		}
+		auto& range = mCellRanges[i];
+		range.min = getCell(mBounds[i].min);
+		range.max = getCell(mBounds[i].max);
 
-		#pragma omp critical
-		for (auto& b : binSet)
-			mBins[b].emplace_back(i);
+		for (auto y = range.min.y; y <= range.max.y; ++y)
+			for (auto x = range.min.x; x <= range.max.x; ++x)
+			{
+				#pragma omp atomic
+				++mCellStart[x + y * mGridSpan.x + 1];
+			}
 	}
-}
 
-void SpatialGrid::onColliderAddition()
-{}
+	for (size_t i = 1; i < mCellStart.size(); ++i)
+		mCellStart[i] += mCellStart[i - 1];
 
-void CollisionDetector::addCollider(Object object)
-{
-	mBroadphase->addCollider(object);
+	std::copy(mCellStart.begin(), mCellStart.end() - 1, mCellCursor.begin());
+	mCellObjects.resize(mCellStart.back());
+
+	// scatter pass
+	#pragma omp parallel for schedule(static)
+	for (CollisionID i = 0; i < mObjects.size(); ++i)
+	{
+		const auto& range = mCellRanges[i];
+		for (auto y = range.min.y; y <= range.max.y; ++y)
+			for (auto x = range.min.x; x <= range.max.x; ++x)
+			{
+				size_t slot;
+				#pragma omp atomic capture
+				slot = mCellCursor[x + y * mGridSpan.x]++;
+
+				mCellObjects[slot] = i;
+			}
+	}
 }
 
-void CollisionDetector::setBroadPhaseDetector(std::unique_ptr<BroadPhaseDetector>&& detector)
+uvec2 SpatialGrid::getCell(vec2 position) const
 {
-	mBroadphase.swap(detector);
+	auto cell = (position + AREA_SIZE + float(mGridSize / 2)) / static_cast<float>(mGridSize);
+	return static_cast<uvec2>(clamp(cell, vec2(0.f), static_cast<vec2>(mGridSpan - 1u)));
 }
 
-void CollisionDetector::update()
+void SpatialGrid::onColliderAddition()
+{}
+
+void SpatialGrid::queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const
 {
-	auto pairs = mBroadphase->generatePairs();
-	mCollisions.clear();
+	auto min = getCell(region.min);
+	auto max = getCell(region.max);
 
-	#pragma omp parallel for shared(mCollisions)
-	for (size_t i = 0; i < pairs.size(); ++i)
-	{
-		const auto& p = pairs[i];
-		if (GJK(mBroadphase->getObject(p.first), mBroadphase->getObject(p.second)))
+	for (auto y = min.y; y <= max.y; ++y)
+		for (auto x = min.x; x <= max.x; ++x)
 		{
-			#pragma omp critical
-			mCollisions.emplace_back(p.first, p.second);
+			size_t cell = x + y * mGridSpan.x;
+			for (size_t i = mCellStart[cell]; i < mCellStart[cell + 1]; ++i)
+			{
+				auto id = mCellObjects[i];
+
+				// objects covering several cells of the region are reported by the first one
+				if (glm::max(mCellRanges[id].min, min) == uvec2(x, y) && mBounds[id].intersects(region))
+					candidates.emplace_back(id);
+			}
 		}
-	}
 }
 
-std::vector<CollisionID> CollisionDetector::queryCollision(CollisionID id)
+void SpatialGrid::traceRay(const Ray& ray, const RayVisitor& visit) const
 {
-	std::vector<CollisionID> query;
+	float limit = 1.f;
+	std::optional<ivec2> previous;
+
+	auto visitCell = [&](ivec2 cell)
+	{
+		for (size_t i = mCellStart[cell.x + cell.y * mGridSpan.x]; i < mCellStart[cell.x + cell.y * mGridSpan.x + 1]; ++i)
+		{
+			auto id = mCellObjects[i];
+			const auto& range = mCellRanges[id];
 
-	for (const auto& c : mCollisions)
-		if (c.first == id) query.emplace_back(c.second);
-		else if (c.second == id) query.emplace_back(c.first);
+			// the ray enters the cell range of an object once, it's reported there
+			bool seen = previous && all(greaterThanEqual(uvec2(*previous), range.min)) && all(lessThanEqual(uvec2(*previous), range.max));
+			if (!seen && ray.enters(mBounds[id], limit))
+				limit = visit(id);
+		}
 
-	return query;
-}
+		previous = cell;
+		return limit;
+	};
 
-bool CollisionDetector::queryIsColliding(CollisionID id)
-{
-	for (const auto& c : mCollisions)
-		if (c.first == id || c.second == id) return true;
-	return false;
+	walkCells(ray, ivec2(getCell(ray.origin)), -(AREA_SIZE + float(mGridSize / 2)), static_cast<float>(mGridSize), ivec2(0), ivec2(mGridSpan - 1u), visitCell);
 }
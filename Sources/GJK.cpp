@@ -1,4 +1,5 @@
 ﻿#include "GJK.hpp"
+#include "NarrowPhase.hpp"
 #include <algorithm>
 #include <memory>
 
@@ -6,11 +7,6 @@ using namespace glm;
 
 namespace
 {
-	vec2 trippleProd(const vec2& a, const vec2& b, const vec2& c)
-	{
-		return b * dot(a, c) - a * dot(b, c);
-	}
-
 	std::vector<vec2> createConvexEnvelope(std::vector<vec2> points)
 	{
 		vec2 pivot;
@@ -77,86 +73,27 @@ namespace
 
 GJK::GJK(const Hull& a, const Hull& b)
 	: NarrowPhaseDetector(a, b)
+	, mStorageA(a)
+	, mStorageB(b)
 {
 }
 
 GJK::operator bool()
 {
-	vec2 direction = { 1, 0 }; // TODO pick better direction ??
-	vec2 simplex[3];
-
-	// simplex 0 - point (edge case)
-	{
-		simplex[0] = support(direction);
-		if (dot(simplex[0], direction) <= 0.f)
-			return false;
-
-		direction = -simplex[0];
-	}
-
-	// simplex 1 - line (edge case)
-	{
-		simplex[1] = support(direction);
-		if (dot(simplex[1], direction) <= 0.f)
-			return false;
-
-		vec2 ab = simplex[0] - simplex[1]; // from point A to B
-
-		direction = trippleProd(ab, -simplex[1], ab); // normal to AB towards Origin
-		if (dot(direction, direction) == 0.f)
-			direction = { ab.y, -ab.x }; // perpendicular vector
-	}
-
-	while (true) 
-	{
-		simplex[2] = support(direction);
-		if (dot(simplex[2], direction) <= 0.f)
-			return false;
-
-		vec2 ao = -simplex[2];
-		vec2 ab = simplex[1] - simplex[2];
-		vec2 ac = simplex[0] - simplex[2];
-		vec2 acn = trippleProd(ab, ac, ac); // normal to AC
-
-		if (dot(acn, ao) >= 0)
-			direction = acn; // new direction is normal to AC towards Origin
-		else 
-		{
-			vec2 abn = trippleProd(ac, ab, ab); // normal to AB
-			if (dot(abn, ao) < 0.f)
-				return true;
-
-			simplex[0] = simplex[1];
-			direction = abn; // new direction is normal to AB towards Origin
-		}
-
-		simplex[1] = simplex[2]; // swap element in the middle (point B)
-	}
+	return GJKPolicy::intersects(mStorageA.view(), mStorageB.view());
+}
 
-	return false;
+void GJK::setHulls(const Hull& a, const Hull& b)
+{
+	mHullA = a;
+	mHullB = b;
+	mStorageA = HullStorage(a);
+	mStorageB = HullStorage(b);
 }
 
 vec2 GJK::support(const vec2& direction)
 {
-	const auto furthestPoint = [](const vec2& direction, const Hull& hull)
-	{
-		float max = dot(direction, hull.front());
-		size_t index = 0;
-
-		for (size_t i = 1; i < hull.size(); i++)
-		{
-			if (float product = dot(direction, hull[i]); product > max)
-			{
-				max = product;
-				index = i;
-			}
-		}
-		return index;
-	};
-
-	size_t i = furthestPoint(direction, mHullA);
-	size_t j = furthestPoint(-direction, mHullB);
-	return mHullA[i] - mHullB[j];
+	return GJKPolicy::support(mStorageA.view(), mStorageB.view(), direction);
 }
 
 GJKVisualizer::GJKVisualizer()
@@ -166,8 +103,7 @@ GJKVisualizer::GJKVisualizer()
 
 void GJKVisualizer::simulate(const Hull& a, const Hull& b)
 {
-	mHullA = a; 
-	mHullB = b;
+	setHulls(a, b);
 
 	mDrawStack.clear();
 	DrawCall drawCall;
@@ -354,7 +290,7 @@ void GJKVisualizer::simulate(const Hull& a, const Hull& b)
 		
 		vec2 ab = simplex[0] - simplex[1]; // from point A to B
 
-		direction = trippleProd(ab, -simplex[1], ab); // normal to AB towards Origin
+		direction = GJKPolicy::tripleProduct(ab, -simplex[1], ab); // normal to AB towards Origin
 		if (dot(direction, direction) == 0.f)
 			direction = { ab.y, -ab.x }; // perpendicular vector
 
@@ -408,7 +344,7 @@ void GJKVisualizer::simulate(const Hull& a, const Hull& b)
 			vec2 ao = -simplex[2];
 			vec2 bc = simplex[1] - simplex[2];
 			vec2 ac = simplex[0] - simplex[2];
-			vec2 acn = trippleProd(bc, ac, ac); // normal to AC
+			vec2 acn = GJKPolicy::tripleProduct(bc, ac, ac); // normal to AC
 
 			drawCross();
 			drawEnvelope();
@@ -424,7 +360,7 @@ void GJKVisualizer::simulate(const Hull& a, const Hull& b)
 				direction = acn; // new direction is normal to AC towards Origin
 			else
 			{
-				vec2 abn = trippleProd(ac, bc, bc); // normal to BC
+				vec2 abn = GJKPolicy::tripleProduct(ac, bc, bc); // normal to BC
 				if (dot(abn, ao) < 0.f)
 				{
 					drawCross();
@@ -0,0 +1,245 @@
+#include "HierarchicalGrid.hpp"
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+using namespace glm;
+
+namespace
+{
+	size_t hashKey(uint64_t key)
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdull;
+		key ^= key >> 33;
+		return static_cast<size_t>(key);
+	}
+}
+
+HierarchicalGrid::HierarchicalGrid(float cellSize, size_t levels)
+	: mCellSize(cellSize)
+	, mLevels(std::min(std::max(levels, size_t(1)), MAX_LEVELS))
+{
+}
+
+Pairs HierarchicalGrid::generatePairs()
+{
+	makeCells();
+
+	Pairs pairs;
+
+	#pragma omp parallel
+	{
+		Pairs localPairs;
+
+		#pragma omp for schedule(dynamic, 64) nowait
+		for (CollisionID i = 0; i < mObjects.size(); ++i)
+		{
+			const auto& bound = mBounds[i];
+			auto ownLevel = mPlacements[i].level;
+
+			// same level and every coarser one, finer objects query us instead
+			for (auto level = ownLevel; level < mLevels; ++level)
+			{
+				if (!(mUsedLevels & (uint64_t(1) << level)))
+					continue;
+
+				auto min = level == ownLevel ? mPlacements[i].min : getCell(bound.min, level);
+				auto max = level == ownLevel ? mPlacements[i].max : getCell(bound.max, level);
+
+				for (auto y = min.y; y <= max.y; ++y)
+					for (auto x = min.x; x <= max.x; ++x)
+					{
+						auto cell = findCell(getKey({ x, y }, level));
+						if (!cell)
+							continue;
+
+						for (auto e = cell->begin; e < cell->end; ++e)
+						{
+							auto j = mEntries[e].objectID;
+							if (level == ownLevel && j <= i)
+								continue;
+
+							// objects sharing several cells are reported only by the first shared one
+							if (glm::max(min, mPlacements[j].min) != ivec2(x, y))
+								continue;
+
+							if (bound.intersects(mBounds[j]))
+								localPairs.emplace_back(i, j);
+						}
+					}
+			}
+		}
+
+		#pragma omp critical (pairs)
+		pairs.insert(pairs.end(), localPairs.begin(), localPairs.end());
+	}
+
+	return pairs;
+}
+
+void HierarchicalGrid::queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const
+{
+	for (size_t level = 0; level < mLevels; ++level)
+	{
+		if (!(mUsedLevels & (uint64_t(1) << level)))
+			continue;
+
+		auto min = getCell(region.min, level);
+		auto max = getCell(region.max, level);
+
+		for (auto y = min.y; y <= max.y; ++y)
+			for (auto x = min.x; x <= max.x; ++x)
+			{
+				auto cell = findCell(getKey({ x, y }, level));
+				if (!cell)
+					continue;
+
+				for (auto e = cell->begin; e < cell->end; ++e)
+				{
+					auto id = mEntries[e].objectID;
+
+					// objects covering several cells of the region are reported by the first one
+					if (glm::max(min, mPlacements[id].min) == ivec2(x, y) && mBounds[id].intersects(region))
+						candidates.emplace_back(id);
+				}
+			}
+	}
+}
+
+void HierarchicalGrid::traceRay(const Ray& ray, const RayVisitor& visit) const
+{
+	float limit = 1.f;
+
+	// levels are walked one after another, the cut carries over
+	for (size_t level = 0; level < mLevels; ++level)
+	{
+		if (!(mUsedLevels & (uint64_t(1) << level)))
+			continue;
+
+		std::optional<ivec2> previous;
+
+		auto visitCell = [&](ivec2 cell)
+		{
+			if (auto found = findCell(getKey(cell, level)))
+				for (auto e = found->begin; e < found->end; ++e)
+				{
+					auto id = mEntries[e].objectID;
+					const auto& placement = mPlacements[id];
+
+					// wrapped keys share cells, the ray enters the cell range of an object once and it's reported there
+					auto inRange = [&](ivec2 c) { return all(greaterThanEqual(c, placement.min)) && all(lessThanEqual(c, placement.max)); };
+					if (inRange(cell) && !(previous && inRange(*previous)) && ray.enters(mBounds[id], limit))
+						limit = visit(id);
+				}
+
+			previous = cell;
+			return limit;
+		};
+
+		auto cellSize = mCellSize * static_cast<float>(uint64_t(1) << level);
+		walkCells(ray, getCell(ray.origin, level), vec2(0.f), cellSize, ivec2(std::numeric_limits<int>::min()), ivec2(std::numeric_limits<int>::max()), visitCell);
+	}
+}
+
+void HierarchicalGrid::onColliderAddition()
+{}
+
+void HierarchicalGrid::makeCells()
+{
+	updateBounds();
+	mPlacements.resize(mObjects.size());
+	mEntryStart.resize(mObjects.size() + 1);
+	mEntryStart[0] = 0;
+
+	uint64_t usedLevels = 0;
+
+	#pragma omp parallel for schedule(static) reduction(|:usedLevels)
+	for (CollisionID i = 0; i < mObjects.size(); ++i)
+	{
+		const auto& bound = mBounds[i];
+		auto size = bound.max - bound.min;
+		auto extent = glm::max(size.x, size.y);
+
+		// smallest level whose cells are at least as large as the object
+		size_t level = 0;
+		for (auto cellSize = mCellSize; cellSize < extent && level + 1 < mLevels; cellSize *= 2.f)
+			++level;
+
+		auto& placement = mPlacements[i];
+		placement.level = level;
+		placement.min = getCell(bound.min, level);
+		placement.max = getCell(bound.max, level);
+
+		auto span = placement.max - placement.min + 1;
+		mEntryStart[i + 1] = static_cast<size_t>(span.x) * static_cast<size_t>(span.y);
+		usedLevels |= uint64_t(1) << level;
+	}
+
+	mUsedLevels = usedLevels;
+	for (size_t i = 1; i < mEntryStart.size(); ++i)
+		mEntryStart[i] += mEntryStart[i - 1];
+
+	mEntries.resize(mEntryStart.back());
+
+	#pragma omp parallel for schedule(static)
+	for (CollisionID i = 0; i < mObjects.size(); ++i)
+	{
+		const auto& placement = mPlacements[i];
+		auto slot = mEntryStart[i];
+
+		for (auto y = placement.min.y; y <= placement.max.y; ++y)
+			for (auto x = placement.min.x; x <= placement.max.x; ++x)
+				mEntries[slot++] = { getKey({ x, y }, placement.level), i };
+	}
+
+	std::sort(mEntries.begin(), mEntries.end(), [](const Entry& a, const Entry& b) { return a.key < b.key; });
+
+	// only occupied cells go into the table
+	size_t cellCount = 0;
+	for (size_t e = 0; e < mEntries.size(); ++e)
+		if (e == 0 || mEntries[e].key != mEntries[e - 1].key)
+			++cellCount;
+
+	size_t capacity = 16;
+	while (capacity < cellCount * 2)
+		capacity *= 2;
+
+	mTable.assign(capacity, Cell());
+
+	for (size_t begin = 0, end = 0; begin < mEntries.size(); begin = end)
+	{
+		auto key = mEntries[begin].key;
+		while (end < mEntries.size() && mEntries[end].key == key)
+			++end;
+
+		auto slot = hashKey(key) & (capacity - 1);
+		while (mTable[slot].key != EMPTY_KEY)
+			slot = (slot + 1) & (capacity - 1);
+
+		mTable[slot] = { key, begin, end };
+	}
+}
+
+ivec2 HierarchicalGrid::getCell(vec2 position, size_t level) const
+{
+	auto size = mCellSize * static_cast<float>(uint64_t(1) << level);
+	return static_cast<ivec2>(floor(position / size));
+}
+
+uint64_t HierarchicalGrid::getKey(ivec2 cell, size_t level) const
+{
+	// 5 bits of level, 29 bits per coordinate; wrapped coordinates only cost extra AABB tests
+	constexpr uint64_t mask = (uint64_t(1) << 29) - 1;
+	return (uint64_t(level) << 58) | ((uint64_t(static_cast<uint32_t>(cell.x)) & mask) << 29) | (uint64_t(static_cast<uint32_t>(cell.y)) & mask);
+}
+
+const HierarchicalGrid::Cell* HierarchicalGrid::findCell(uint64_t key) const
+{
+	auto mask = mTable.size() - 1;
+	for (auto slot = hashKey(key) & mask; mTable[slot].key != EMPTY_KEY; slot = (slot + 1) & mask)
+		if (mTable[slot].key == key)
+			return &mTable[slot];
+
+	return nullptr;
+}
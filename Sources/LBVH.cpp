@@ -0,0 +1,361 @@
+#include "LBVH.hpp"
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <omp.h>
+
+using namespace glm;
+
+namespace
+{
+	uint32_t expandBits(uint32_t v)
+	{
+		// spreads the low 16 bits so there is a zero between each of them
+		v &= 0x0000ffffu;
+		v = (v | (v << 8)) & 0x00ff00ffu;
+		v = (v | (v << 4)) & 0x0f0f0f0fu;
+		v = (v | (v << 2)) & 0x33333333u;
+		v = (v | (v << 1)) & 0x55555555u;
+		return v;
+	}
+
+	uint32_t morton(vec2 normalized)
+	{
+		auto cell = static_cast<uvec2>(clamp(normalized * 65536.f, vec2(0.f), vec2(65535.f)));
+		return (expandBits(cell.y) << 1) | expandBits(cell.x);
+	}
+}
+
+Pairs LBVHDetector::generatePairs()
+{
+	updateBounds();
+
+	if (mObjects.size() < 2)
+		return {};
+
+	computeMortonCodes();
+	sortMortonCodes();
+	buildHierarchy();
+	refitBounds();
+
+	mThreadPairs.resize(omp_get_max_threads());
+	for (auto& p : mThreadPairs)
+		p.clear();
+
+	auto leafCount = static_cast<uint32_t>(mObjects.size());
+
+	// each leaf walks the tree and reports pairs with the leaves sorted after it
+	#pragma omp parallel
+	{
+		auto& localPairs = mThreadPairs[omp_get_thread_num()];
+		std::vector<uint32_t> stack;
+
+		#pragma omp for schedule(dynamic, 64) nowait
+		for (int64_t i = 0; i < static_cast<int64_t>(leafCount); ++i)
+		{
+			auto leaf = static_cast<uint32_t>(i);
+			const auto& bound = mLeafBounds[leaf];
+			stack.assign(1, 0);
+
+			while (!stack.empty())
+			{
+				const auto& node = mNodes[stack.back()];
+				stack.pop_back();
+
+				for (auto child : node.children)
+				{
+					if (child & LEAF_FLAG)
+					{
+						auto other = child & ~LEAF_FLAG;
+						if (other > leaf && bound.intersects(mLeafBounds[other]))
+							localPairs.emplace_back(mSortedIDs[leaf], mSortedIDs[other]);
+					}
+					else if (mNodes[child].last > leaf && bound.intersects(mNodes[child].bounds))
+						stack.emplace_back(child);
+				}
+			}
+		}
+	}
+
+	Pairs pairs;
+	mergeThreadBuffers(mThreadPairs, pairs);
+	return pairs;
+}
+
+void LBVHDetector::queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const
+{
+	// no hierarchy is built for fewer than two objects
+	if (mObjects.size() < 2)
+	{
+		BroadPhaseDetector::queryBounds(region, candidates);
+		return;
+	}
+
+	std::vector<uint32_t> stack(1, 0);
+
+	while (!stack.empty())
+	{
+		const auto& node = mNodes[stack.back()];
+		stack.pop_back();
+
+		for (auto child : node.children)
+		{
+			if (child & LEAF_FLAG)
+			{
+				auto leaf = child & ~LEAF_FLAG;
+				if (region.intersects(mLeafBounds[leaf]))
+					candidates.emplace_back(mSortedIDs[leaf]);
+			}
+			else if (region.intersects(mNodes[child].bounds))
+				stack.emplace_back(child);
+		}
+	}
+}
+
+void LBVHDetector::traceRay(const Ray& ray, const RayVisitor& visit) const
+{
+	if (mObjects.size() < 2)
+	{
+		BroadPhaseDetector::traceRay(ray, visit);
+		return;
+	}
+
+	// nodes with the fraction the ray enters them, the nearer child is popped first
+	float limit = 1.f;
+	std::vector<std::pair<uint32_t, float>> stack;
+	if (auto enter = ray.enters(mNodes[0].bounds))
+		stack.emplace_back(0, *enter);
+
+	while (!stack.empty())
+	{
+		auto [index, enter] = stack.back();
+		stack.pop_back();
+
+		if (enter >= limit)
+			continue;
+
+		if (index & LEAF_FLAG)
+		{
+			limit = visit(mSortedIDs[index & ~LEAF_FLAG]);
+			continue;
+		}
+
+		const auto& node = mNodes[index];
+		uint32_t children[2] = { node.children[0], node.children[1] };
+		auto bounds = [&](uint32_t child) -> const AABB& { return child & LEAF_FLAG ? mLeafBounds[child & ~LEAF_FLAG] : mNodes[child].bounds; };
+		std::optional<float> enters[2] = { ray.enters(bounds(children[0]), limit), ray.enters(bounds(children[1]), limit) };
+		if (enters[0] < enters[1])
+		{
+			std::swap(children[0], children[1]);
+			std::swap(enters[0], enters[1]);
+		}
+
+		for (size_t c = 0; c < 2; ++c)
+			if (enters[c])
+				stack.emplace_back(children[c], *enters[c]);
+	}
+}
+
+void LBVHDetector::onColliderAddition()
+{}
+
+void LBVHDetector::computeMortonCodes()
+{
+	auto count = static_cast<int64_t>(mObjects.size());
+
+	mMortonCodes.resize(count);
+	mSortedIDs.resize(count);
+	mTempCodes.resize(count);
+	mTempIDs.resize(count);
+	mLeafBounds.resize(count);
+	mLeafParents.resize(count);
+	mNodes.resize(count - 1);
+
+	if (mVisitsSize < mNodes.size())
+	{
+		mVisits = std::make_unique<std::atomic<uint32_t>[]>(mNodes.size());
+		mVisitsSize = mNodes.size();
+	}
+	float minX = std::numeric_limits<float>::max(), minY = minX;
+	float maxX = std::numeric_limits<float>::lowest(), maxY = maxX;
+
+	#pragma omp parallel for schedule(static) reduction(min:minX, minY) reduction(max:maxX, maxY)
+	for (int64_t i = 0; i < count; ++i)
+	{
+		auto center = (mBounds[i].min + mBounds[i].max) * 0.5f;
+		minX = std::min(minX, center.x);
+		minY = std::min(minY, center.y);
+		maxX = std::max(maxX, center.x);
+		maxY = std::max(maxY, center.y);
+	}
+
+	vec2 sceneMin = { minX, minY };
+	vec2 sceneSize = glm::max(vec2(maxX, maxY) - sceneMin, vec2(std::numeric_limits<float>::epsilon()));
+
+	#pragma omp parallel for schedule(static)
+	for (int64_t i = 0; i < count; ++i)
+	{
+		auto center = (mBounds[i].min + mBounds[i].max) * 0.5f;
+		mMortonCodes[i] = morton((center - sceneMin) / sceneSize);
+		mSortedIDs[i] = static_cast<uint32_t>(i);
+	}
+}
+
+void LBVHDetector::sortMortonCodes()
+{
+	// LSD radix sort, 8 bits per pass; stable, so equal codes stay ordered by ID
+	constexpr size_t RADIX = 256;
+	auto count = mMortonCodes.size();
+	mHistograms.resize(RADIX * omp_get_max_threads());
+
+	for (uint32_t shift = 0; shift < 32; shift += 8)
+	{
+		#pragma omp parallel
+		{
+			auto thread = static_cast<size_t>(omp_get_thread_num());
+			auto threads = static_cast<size_t>(omp_get_num_threads());
+			auto begin = count * thread / threads;
+			auto end = count * (thread + 1) / threads;
+			auto histogram = mHistograms.begin() + thread * RADIX;
+
+			std::fill(histogram, histogram + RADIX, 0);
+			for (auto i = begin; i < end; ++i)
+				++histogram[(mMortonCodes[i] >> shift) & (RADIX - 1)];
+
+			#pragma omp barrier
+			#pragma omp single
+			{
+				// offsets ordered by (digit, thread) keep the sort stable
+				size_t offset = 0;
+				for (size_t digit = 0; digit < RADIX; ++digit)
+					for (size_t t = 0; t < threads; ++t)
+					{
+						auto size = mHistograms[t * RADIX + digit];
+						mHistograms[t * RADIX + digit] = offset;
+						offset += size;
+					}
+			}
+
+			for (auto i = begin; i < end; ++i)
+			{
+				auto slot = histogram[(mMortonCodes[i] >> shift) & (RADIX - 1)]++;
+				mTempCodes[slot] = mMortonCodes[i];
+				mTempIDs[slot] = mSortedIDs[i];
+			}
+		}
+
+		mMortonCodes.swap(mTempCodes);
+		mSortedIDs.swap(mTempIDs);
+	}
+}
+
+int LBVHDetector::delta(int i, int j) const
+{
+	// length of the common prefix of keys i and j, ties are broken by the index
+	if (j < 0 || j >= static_cast<int>(mMortonCodes.size()))
+		return -1;
+
+	if (mMortonCodes[i] == mMortonCodes[j])
+		return 32 + std::countl_zero(static_cast<uint32_t>(i ^ j));
+
+	return std::countl_zero(mMortonCodes[i] ^ mMortonCodes[j]);
+}
+
+void LBVHDetector::buildHierarchy()
+{
+	auto leafCount = static_cast<int>(mObjects.size());
+	mNodes[0].parent = NULL_NODE;
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < leafCount; ++i)
+		mLeafBounds[i] = mBounds[mSortedIDs[i]];
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < leafCount - 1; ++i)
+	{
+		// direction of the range covered by node i
+		int d = delta(i, i + 1) - delta(i, i - 1) > 0 ? 1 : -1;
+		int deltaMin = delta(i, i - d);
+
+		// upper bound for the range length, then binary search for the other end
+		int lengthMax = 2;
+		while (delta(i, i + lengthMax * d) > deltaMin)
+			lengthMax *= 2;
+
+		int length = 0;
+		for (int t = lengthMax / 2; t >= 1; t /= 2)
+			if (delta(i, i + (length + t) * d) > deltaMin)
+				length += t;
+
+		int j = i + length * d;
+		int deltaNode = delta(i, j);
+
+		// binary search for the split position
+		int split = 0;
+		for (int divisor = 2; ; divisor *= 2)
+		{
+			int t = (length + divisor - 1) / divisor;
+			if (delta(i, i + (split + t) * d) > deltaNode)
+				split += t;
+			if (t == 1)
+				break;
+		}
+
+		int gamma = i + split * d + std::min(d, 0);
+		int first = std::min(i, j);
+		int last = std::max(i, j);
+
+		auto& node = mNodes[i];
+		node.last = static_cast<uint32_t>(last);
+
+		if (first == gamma)
+		{
+			node.children[0] = static_cast<uint32_t>(gamma) | LEAF_FLAG;
+			mLeafParents[gamma] = static_cast<uint32_t>(i);
+		}
+		else
+		{
+			node.children[0] = static_cast<uint32_t>(gamma);
+			mNodes[gamma].parent = static_cast<uint32_t>(i);
+		}
+
+		if (last == gamma + 1)
+		{
+			node.children[1] = static_cast<uint32_t>(gamma + 1) | LEAF_FLAG;
+			mLeafParents[gamma + 1] = static_cast<uint32_t>(i);
+		}
+		else
+		{
+			node.children[1] = static_cast<uint32_t>(gamma + 1);
+			mNodes[gamma + 1].parent = static_cast<uint32_t>(i);
+		}
+	}
+}
+
+void LBVHDetector::refitBounds()
+{
+	auto leafCount = static_cast<int>(mObjects.size());
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < leafCount - 1; ++i)
+		mVisits[i].store(0, std::memory_order_relaxed);
+
+	// every leaf walks up, the second thread to reach a node merges its children
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < leafCount; ++i)
+	{
+		for (auto node = mLeafParents[i]; node != NULL_NODE; node = mNodes[node].parent)
+		{
+			if (mVisits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+				break;
+
+			auto childBounds = [&](uint32_t child) -> const AABB&
+			{
+				return (child & LEAF_FLAG) ? mLeafBounds[child & ~LEAF_FLAG] : mNodes[child].bounds;
+			};
+
+			auto& n = mNodes[node];
+			n.bounds = childBounds(n.children[0]).merge(childBounds(n.children[1]));
+		}
+	}
+}
@@ -3,7 +3,7 @@
 #include <SFML/Window/Keyboard.hpp>
 
 #include "GJK.hpp"
-#include "QuadTree.hpp"
+#include "BroadPhaseTuner.hpp"
 
 using namespace glm;
 
@@ -14,6 +14,20 @@ PerfBench::PerfBench(sf::Window& window)
 	size_t defaultPolygonCount = 1000;
 	mPolygons.generatePolygons(defaultPolygonCount);
 
+	// polygons are moved to local space around their center, motion only changes the transform
+	for (size_t i = 0; i < defaultPolygonCount; ++i)
+	{
+		const auto& polygon = mPolygons[i];
+		AABB bounds(polygon);
+		auto center = (bounds.min + bounds.max) * 0.5f;
+
+		for (auto& v : polygon)
+			v -= center;
+
+		mTransforms.push_back({ center });
+		mLocalBounds.emplace_back(bounds.min - center, bounds.max - center);
+	}
+
 	// create shapes
 	for (size_t i = 0; i < defaultPolygonCount; ++i)
 	{
@@ -25,11 +39,16 @@ PerfBench::PerfBench(sf::Window& window)
 		for (size_t j = 0; j < polygon.size(); ++j)
 			shape.setPoint(j, reinterpret_cast<sf::Vector2f&>(polygon[j]));
 
+		shape.setPosition(mTransforms[i].position.x, mTransforms[i].position.y);
 		mShapes.emplace_back(shape);
 	}
 
-	//mColliDetector.setBroadPhaseDetector(std::make_unique<SpatialGrid>(225)); // TODO alg switching
-	mColliDetector.setBroadPhaseDetector(std::make_unique<QuadTreeDetector>(10, 5));
+	mColliDetector.setBroadPhaseDetector(std::make_unique<BroadPhaseTuner>());
+	mColliDetector.setVelocities(mPolygons.getDirections());
+	mColliDetector.setTransforms(mTransforms);
+
+	mBounds.resize(defaultPolygonCount);
+	mColliDetector.setBounds(mBounds);
 	for (auto& p : mPolygons.data())
 		mColliDetector.addCollider(p);
 }
@@ -54,7 +73,7 @@ void PerfBench::update(float dt)
 	move(delta.x, delta.y);
 
 	updatePolygons(dt);
-	mColliDetector.update();
+	mColliDetector.update(dt);
 
 	auto position = getPosition();
 	position.x = std::min(std::max(position.x, -AREA_SIZE.x + mWindow.getSize().x), AREA_SIZE.x);
@@ -106,6 +125,7 @@ void PerfBench::onEvent(const sf::Event& event)
 {
 }
 
+// moves the polygons and writes their bounds in the same pass, the broadphase only reads them
 void PerfBench::updatePolygons(float dt)
 {
 	//vec2 halfArea = { (MAX_AREA.x - mWindow.getSize().x) / 2, (MAX_AREA.y - mWindow.getSize().y) / 2 };
@@ -113,33 +133,25 @@ void PerfBench::updatePolygons(float dt)
 	#pragma omp parallel for schedule(static)
 	for (size_t i = 0; i < mPolygons.size(); ++i)
 	{
-		auto polygon = mPolygons[i];
+		auto& position = mTransforms[i].position;
 		auto& direction = mPolygons.getDirections()[i];
-		auto speed = direction * dt;
-		
-		bool pushX = false;
-		bool pushY = false;
-		for (auto& v : polygon)
-		{
-			v += speed;
+		position += direction * dt;
 
-			if (v.x < -AREA_SIZE.x || v.x > AREA_SIZE.x) 
-				pushX = true;
-			if (v.y < -AREA_SIZE.y || v.y > AREA_SIZE.y) 
-				pushY = true;
-		}
+		auto min = mLocalBounds[i].min + position;
+		auto max = mLocalBounds[i].max + position;
+		bool pushX = min.x < -AREA_SIZE.x || max.x > AREA_SIZE.x;
+		bool pushY = min.y < -AREA_SIZE.y || max.y > AREA_SIZE.y;
 
 		if (pushX || pushY)
 		{
 			if (pushX) direction.x = -direction.x;
 			if (pushY) direction.y = -direction.y;
 
-			speed = direction * dt;
-			for (auto& v : polygon)
-				v += speed;
+			position += direction * dt;
 		}
 
-		for (size_t j = 0; j < polygon.size(); ++j)
-			mShapes[i].setPoint(j, reinterpret_cast<sf::Vector2f&>(polygon[j]));
+		mBounds[i] = { mLocalBounds[i].min + position, mLocalBounds[i].max + position };
+
+		mShapes[i].setPosition(position.x, position.y);
 	}
 }
@@ -1,123 +1,414 @@
 #include "QuadTree.hpp"
 #include "Constants.hpp"
+#include "SIMD.hpp"
+#include <algorithm>
+#include <bit>
+#include <omp.h>
 
-namespace
+QuadTreeDetector::QuadTreeDetector(size_t maxNodeObjects, size_t maxDepth, bool incremental, float looseness)
+    : mMaxNodeObjects(maxNodeObjects)
+    , mMaxDepth(maxDepth)
+    , mIncremental(incremental)
+    , mLooseness(glm::max(looseness, 1.f))
 {
-    size_t mMaxNodeObjects;
-    size_t mMaxDepth;
-}
-
-QuadTreeDetector::QuadTreeDetector(size_t maxNodeObjects, size_t maxDepth)
-{
-    mMaxDepth = maxDepth;
-    mMaxNodeObjects = maxNodeObjects;
 }
 
 Pairs QuadTreeDetector::generatePairs()
 {
-    mRoot = std::make_unique<QuadTreeNode>(0, -AREA_SIZE, AREA_SIZE);
+    if (mIncremental && !mNodes.empty())
+        updateIncremental();
+    else
+        rebuild();
+
+    mNodeObjects.resize(mTreeObjects.size());
+    flatten(0, 0);
 
-    for (CollisionID i = 0; i < mObjects.size(); i++)
+    mThreadPairs.resize(omp_get_max_threads());
+    for (auto& p : mThreadPairs)
+        p.clear();
+
+    if (mNodes[0].isLoose())
+        findAllLoosePairs();
+    else
     {
-        mTreeObjects[i].update();
-        mRoot->insert(mTreeObjects[i]);
+        #pragma omp parallel
+        #pragma omp single
+        findAllCollidingPairs(0);
     }
 
     Pairs pairs;
-    mRoot->findAllCollidingPairs(pairs);
+    mergeThreadBuffers(mThreadPairs, pairs);
     return pairs;
 }
 
+void QuadTreeDetector::queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const
+{
+    if (mNodes.empty())
+        return;
+
+    const auto& o = mNodeObjects;
+    std::vector<size_t> stack(1, 0);
+
+    while (!stack.empty())
+    {
+        auto node = stack.back();
+        stack.pop_back();
+
+        // objects outside of the area stay in the root, it's always searched
+        const auto& n = mNodes[node];
+        if (node != 0 && !n.intersects(region.min, region.max))
+            continue;
+
+        for (auto i = n.mBegin; i < n.mEnd; i += AABB_BATCH_SIZE)
+        {
+            auto mask = overlapMask(region.min.x, region.min.y, region.max.x, region.max.y, o.minX.data() + i, o.minY.data() + i, o.maxX.data() + i, o.maxY.data() + i);
+            if (n.mEnd - i < AABB_BATCH_SIZE)
+                mask &= (1u << (n.mEnd - i)) - 1;
+
+            for (; mask; mask &= mask - 1)
+                candidates.emplace_back(o.objectIDs[i + std::countr_zero(mask)]);
+        }
+
+        if (!n.isLeaf())
+            for (size_t c = 0; c < 4; c++)
+                stack.push_back(n.mFirstChild + c);
+    }
+}
+
+void QuadTreeDetector::traceRay(const Ray& ray, const RayVisitor& visit) const
+{
+    if (mNodes.empty())
+        return;
+
+    // nodes with the fraction the ray enters them, nearer children are popped first
+    const auto& o = mNodeObjects;
+    float limit = 1.f;
+    std::vector<std::pair<size_t, float>> stack(1, { 0, 0.f });
+
+    while (!stack.empty())
+    {
+        auto [node, enter] = stack.back();
+        stack.pop_back();
+
+        if (enter >= limit)
+            continue;
+
+        const auto& n = mNodes[node];
+        for (auto i = n.mBegin; i < n.mEnd; ++i)
+            if (ray.enters({ { o.minX[i], o.minY[i] }, { o.maxX[i], o.maxY[i] } }, limit))
+                limit = visit(o.objectIDs[i]);
+
+        if (n.isLeaf())
+            continue;
+
+        std::array<std::pair<size_t, float>, 4> children;
+        size_t count = 0;
+        for (size_t c = 0; c < 4; c++)
+        {
+            const auto& child = mNodes[n.mFirstChild + c];
+            if (auto childEnter = ray.enters({ child.mLooseTopLeft, child.mLooseBotRight }, limit))
+                children[count++] = { n.mFirstChild + c, *childEnter };
+        }
+
+        std::sort(children.begin(), children.begin() + count, [](const auto& a, const auto& b) { return a.second > b.second; });
+        stack.insert(stack.end(), children.begin(), children.begin() + count);
+    }
+}
+
 void QuadTreeDetector::onColliderAddition()
 {
+    // a new object has no node yet, the incremental update inserts it from the root
     mTreeObjects.push_back(QuadTreeObject(mObjects.back(), mObjects.size() - 1));
 }
 
+void QuadTreeDetector::rebuild()
+{
+    mNodes.clear();
+    mFreeChildren.clear();
+    mNodes.emplace_back(0, -AREA_SIZE, AREA_SIZE, NULL_INDEX, mLooseness);
+    updateBounds();
+
+    for (size_t i = 0; i < mTreeObjects.size(); i++)
+    {
+        auto& object = mTreeObjects[i];
+        object.update(mBounds[i]);
+        object.node = object.prev = object.next = NULL_INDEX;
+        insert(0, i);
+    }
+}
+
+void QuadTreeDetector::updateIncremental()
+{
+    updateBounds();
+
+    for (size_t i = 0; i < mTreeObjects.size(); i++)
+    {
+        auto& object = mTreeObjects[i];
+        object.update(mBounds[i]);
+
+        auto node = object.node;
+        if (node != NULL_INDEX && fits(node, object))
+            continue;
+
+        // climb to the closest ancestor still containing the object and reinsert from there
+        if (node != NULL_INDEX)
+            remove(i);
+        else
+            node = 0;
+
+        while (mNodes[node].mParent != NULL_INDEX && !mNodes[node].inBounds(object))
+            node = mNodes[node].mParent;
+
+        insert(node, i);
+
+        if (object.node != NULL_INDEX)
+            for (auto parent = mNodes[node].mParent; parent != NULL_INDEX; parent = mNodes[parent].mParent)
+                mNodes[parent].mCount++;
+    }
+
+    mergeUnderfull(0);
+}
+
 QuadTreeDetector::QuadTreeObject::QuadTreeObject(Object object, CollisionID objectID) :
     objectID(objectID),
     object(object)
 {
 }
 
-void QuadTreeDetector::QuadTreeObject::update()
+void QuadTreeDetector::QuadTreeObject::update(const AABB& bounds)
 {
-    minBound = glm::vec2(std::numeric_limits<float>::max());
-    maxBound = glm::vec2(std::numeric_limits<float>::lowest());
-    for (auto& vertex : object) // Compute AABB
-    {
-        minBound.x = glm::min(minBound.x, vertex.x);
-        minBound.y = glm::min(minBound.y, vertex.y);
-        maxBound.x = glm::max(maxBound.x, vertex.x);
-        maxBound.y = glm::max(maxBound.y, vertex.y);
-    }
+    minBound = bounds.min;
+    maxBound = bounds.max;
 }
 
-QuadTreeDetector::QuadTreeNode::QuadTreeNode(size_t depth, glm::vec2 topLeft, glm::vec2 botRight) :
+QuadTreeDetector::QuadTreeNode::QuadTreeNode(size_t depth, glm::vec2 topLeft, glm::vec2 botRight, size_t parent, float looseness) :
     mDepth(depth),
     mTopLeft(topLeft),
     mBotRight(botRight),
-    mCenter((topLeft + botRight) * 0.5f)
+    mCenter((topLeft + botRight) * 0.5f),
+    mLooseTopLeft(looseness > 1.f ? mCenter + (topLeft - mCenter) * looseness : topLeft),
+    mLooseBotRight(looseness > 1.f ? mCenter + (botRight - mCenter) * looseness : botRight),
+    mParent(parent)
 {
 }
 
-bool QuadTreeDetector::QuadTreeNode::inBounds(QuadTreeObject& object)
+bool QuadTreeDetector::QuadTreeNode::inBounds(const QuadTreeObject& object) const
 {
-    return object.minBound.x >= mTopLeft.x && object.minBound.y >= mTopLeft.y && object.maxBound.x <= mBotRight.x && object.maxBound.y <= mBotRight.y;
+    return object.minBound.x >= mLooseTopLeft.x && object.minBound.y >= mLooseTopLeft.y && object.maxBound.x <= mLooseBotRight.x && object.maxBound.y <= mLooseBotRight.y;
 }
 
-void QuadTreeDetector::QuadTreeNode::insert(QuadTreeObject& object)
+bool QuadTreeDetector::fits(size_t node, const QuadTreeObject& object) const
 {
-    if (!inBounds(object))
-        return;
+    // the object would be inserted into this very node again, the root takes anything
+    const auto& n = mNodes[node];
+    return (node == 0 || n.inBounds(object)) && (n.isLeaf() || n.getQuadrant(object) == 4);
+}
+
+void QuadTreeDetector::insert(size_t node, size_t object)
+{
+    mNodes[node].mCount++;
 
-    if (isLeaf())
+    if (mNodes[node].isLeaf())
     {
-        if (mDepth >= mMaxDepth || mQuadObjects.size() < mMaxNodeObjects)
-            mQuadObjects.push_back(&object);
+        if (mNodes[node].mDepth >= mMaxDepth || mNodes[node].mCount <= mMaxNodeObjects)
+            addObject(node, object);
         else
         {
-            split();
-            insert(object);
+            mNodes[node].mCount--;
+            split(node);
+            insert(node, object);
         }
     }
     else
     {
-        auto i = getQuadrant(object);
+        auto i = mNodes[node].getQuadrant(mTreeObjects[object]);
         if (i < 4)
-            mSubTrees[i]->insert(object);
+            insert(mNodes[node].mFirstChild + i, object);
         else
-            mQuadObjects.push_back(&object);
+            addObject(node, object);
     }
 }
 
-void QuadTreeDetector::QuadTreeNode::split()
+void QuadTreeDetector::addObject(size_t node, size_t object)
 {
-    mSubTrees[0] = std::make_unique<QuadTreeNode>(mDepth + 1, mTopLeft, mCenter);
-    mSubTrees[1] = std::make_unique<QuadTreeNode>(mDepth + 1, glm::vec2(mCenter.x, mTopLeft.y), glm::vec2(mBotRight.x, mCenter.y));
-    mSubTrees[2] = std::make_unique<QuadTreeNode>(mDepth + 1, glm::vec2(mTopLeft.x, mCenter.y), glm::vec2(mCenter.x, mBotRight.y));
-    mSubTrees[3] = std::make_unique<QuadTreeNode>(mDepth + 1, mCenter, mBotRight);
+    auto& o = mTreeObjects[object];
+    auto& n = mNodes[node];
 
-    auto newValues = std::vector<QuadTreeObject*>();
+    o.node = node;
+    o.prev = NULL_INDEX;
+    o.next = n.mFirstObject;
+    if (n.mFirstObject != NULL_INDEX)
+        mTreeObjects[n.mFirstObject].prev = object;
+    n.mFirstObject = object;
+}
+
+void QuadTreeDetector::unlinkObject(size_t object)
+{
+    auto& o = mTreeObjects[object];
+
+    if (o.prev != NULL_INDEX)
+        mTreeObjects[o.prev].next = o.next;
+    else
+        mNodes[o.node].mFirstObject = o.next;
+
+    if (o.next != NULL_INDEX)
+        mTreeObjects[o.next].prev = o.prev;
+
+    o.node = o.prev = o.next = NULL_INDEX;
+}
+
+void QuadTreeDetector::remove(size_t object)
+{
+    for (auto node = mTreeObjects[object].node; node != NULL_INDEX; node = mNodes[node].mParent)
+        mNodes[node].mCount--;
+
+    unlinkObject(object);
+}
+
+size_t QuadTreeDetector::allocateChildren(size_t node)
+{
+    const auto n = mNodes[node];
+    std::array<QuadTreeNode, 4> children = {
+        QuadTreeNode(n.mDepth + 1, n.mTopLeft, n.mCenter, node, mLooseness),
+        QuadTreeNode(n.mDepth + 1, glm::vec2(n.mCenter.x, n.mTopLeft.y), glm::vec2(n.mBotRight.x, n.mCenter.y), node, mLooseness),
+        QuadTreeNode(n.mDepth + 1, glm::vec2(n.mTopLeft.x, n.mCenter.y), glm::vec2(n.mCenter.x, n.mBotRight.y), node, mLooseness),
+        QuadTreeNode(n.mDepth + 1, n.mCenter, n.mBotRight, node, mLooseness)
+    };
 
-    for (size_t i = 0; i < mQuadObjects.size(); i++)
+    size_t first;
+    if (!mFreeChildren.empty())
     {
-        auto j = getQuadrant(*mQuadObjects[i]);
+        first = mFreeChildren.back();
+        mFreeChildren.pop_back();
+        std::copy(children.begin(), children.end(), mNodes.begin() + first);
+    }
+    else
+    {
+        first = mNodes.size();
+        mNodes.insert(mNodes.end(), children.begin(), children.end());
+    }
+
+    mNodes[node].mFirstChild = first;
+    return first;
+}
+
+void QuadTreeDetector::freeChildren(size_t node)
+{
+    mFreeChildren.push_back(mNodes[node].mFirstChild);
+    mNodes[node].mFirstChild = NULL_INDEX;
+}
+
+void QuadTreeDetector::split(size_t node)
+{
+    auto first = allocateChildren(node);
+    auto object = mNodes[node].mFirstObject;
+    mNodes[node].mFirstObject = NULL_INDEX;
+
+    while (object != NULL_INDEX)
+    {
+        auto next = mTreeObjects[object].next;
+        auto j = mNodes[node].getQuadrant(mTreeObjects[object]);
         if (j < 4)
-            mSubTrees[j]->mQuadObjects.push_back(mQuadObjects[i]);
+        {
+            mNodes[first + j].mCount++;
+            addObject(first + j, object);
+        }
         else
-            newValues.push_back(mQuadObjects[i]);
+            addObject(node, object);
+
+        object = next;
+    }
+}
+
+void QuadTreeDetector::merge(size_t node)
+{
+    // pull every descendant object up into this node and release the children
+    for (size_t i = 0; i < 4; i++)
+    {
+        auto child = mNodes[node].mFirstChild + i;
+        if (!mNodes[child].isLeaf())
+            merge(child);
+
+        for (auto object = mNodes[child].mFirstObject; object != NULL_INDEX; )
+        {
+            auto next = mTreeObjects[object].next;
+            addObject(node, object);
+            object = next;
+        }
     }
 
-    mQuadObjects = std::move(newValues);
+    freeChildren(node);
 }
 
-bool QuadTreeDetector::QuadTreeNode::isLeaf()
+void QuadTreeDetector::mergeUnderfull(size_t node)
 {
-    return !static_cast<bool>(mSubTrees[0]);
+    if (mNodes[node].isLeaf())
+        return;
+
+    // half the split threshold, so nodes don't flip between split and merged every frame
+    if (mNodes[node].mCount <= mMaxNodeObjects / 2)
+        merge(node);
+    else
+        for (size_t i = 0; i < 4; i++)
+            mergeUnderfull(mNodes[node].mFirstChild + i);
 }
 
-size_t QuadTreeDetector::QuadTreeNode::getQuadrant(QuadTreeObject& object)
+size_t QuadTreeDetector::flatten(size_t node, size_t cursor)
 {
+    auto& n = mNodes[node];
+    n.mBegin = cursor;
+
+    for (auto object = n.mFirstObject; object != NULL_INDEX; object = mTreeObjects[object].next)
+    {
+        const auto& o = mTreeObjects[object];
+        mNodeObjects.minX[cursor] = o.minBound.x;
+        mNodeObjects.minY[cursor] = o.minBound.y;
+        mNodeObjects.maxX[cursor] = o.maxBound.x;
+        mNodeObjects.maxY[cursor] = o.maxBound.y;
+        mNodeObjects.objectIDs[cursor++] = o.objectID;
+    }
+
+    n.mEnd = cursor;
+
+    if (!n.isLeaf())
+        for (size_t i = 0; i < 4; i++)
+            cursor = flatten(n.mFirstChild + i, cursor);
+
+    n.mSubtreeEnd = cursor;
+    return cursor;
+}
+
+bool QuadTreeDetector::QuadTreeNode::isLeaf() const
+{
+    return mFirstChild == NULL_INDEX;
+}
+
+bool QuadTreeDetector::QuadTreeNode::isLoose() const
+{
+    return mLooseTopLeft != mTopLeft;
+}
+
+size_t QuadTreeDetector::QuadTreeNode::getQuadrant(const QuadTreeObject& object) const
+{
+    // objects reaching out of the area stay in the root
+    if (!inBounds(object))
+        return 4;
+
+    if (isLoose())
+    {
+        // loose children overlap, take the one holding the object's center if the object fits in it
+        auto center = (object.minBound + object.maxBound) * 0.5f;
+        size_t quadrant = (center.x >= mCenter.x ? 1 : 0) + (center.y >= mCenter.y ? 2 : 0);
+
+        auto childCenter = mCenter + (glm::vec2(quadrant & 1, quadrant >> 1) - 0.5f) * (mBotRight - mTopLeft) * 0.5f;
+        auto childHalfSize = (mLooseBotRight - mLooseTopLeft) * 0.25f;
+
+        auto fits = object.minBound.x >= childCenter.x - childHalfSize.x && object.minBound.y >= childCenter.y - childHalfSize.y
+            && object.maxBound.x <= childCenter.x + childHalfSize.x && object.maxBound.y <= childCenter.y + childHalfSize.y;
+
+        return fits ? quadrant : 4;
+    }
+
     if (object.maxBound.x < mCenter.x)
     {
         if (object.maxBound.y < mCenter.y)
@@ -137,54 +428,113 @@ size_t QuadTreeDetector::QuadTreeNode::getQuadrant(QuadTreeObject& object)
     return 4; // not contained entirely in any quadrant
 }
 
-void QuadTreeDetector::QuadTreeNode::findAllCollidingPairs(Pairs& pairs)
+void QuadTreeDetector::findAllCollidingPairs(size_t node)
 {
-    for (size_t i = 0; i < mQuadObjects.size(); i++)
+    // runs as a task, pairs go to the buffer of whichever thread executes it
+    auto& pairs = mThreadPairs[omp_get_thread_num()];
+
+    const auto& n = mNodes[node];
+    for (size_t i = n.mBegin; i < n.mEnd; i++)
+        collectOverlaps(i, n.mBegin, i, pairs);
+
+    if (!n.isLeaf())
     {
-        for (size_t j = 0; j < i; j++)
+        auto descendants = n.mSubtreeEnd - n.mEnd;
+        for (size_t i = n.mBegin; i < n.mEnd; i += TASK_CHUNK_OBJECTS)
         {
-            if (mQuadObjects[i]->intersects(*mQuadObjects[j]))
+            auto end = glm::min(i + TASK_CHUNK_OBJECTS, n.mEnd);
+
+            #pragma omp task firstprivate(i, end) if(descendants * (end - i) >= TASK_MIN_OBJECTS * TASK_CHUNK_OBJECTS)
             {
-                #pragma omp critical (pairs)
-                pairs.emplace_back(mQuadObjects[i]->objectID, mQuadObjects[j]->objectID);
+                auto& taskPairs = mThreadPairs[omp_get_thread_num()];
+                for (size_t j = i; j < end; j++)
+                    findAllCollidingDescendants(node, j, taskPairs);
             }
         }
-    }
-    if (!isLeaf())
-    {
-        #pragma omp parallel for
-        for (size_t i = 0; i < mSubTrees.size(); i++)
+
+        for (size_t i = 0; i < 4; i++)
         {
-            for (size_t j = 0; j < mQuadObjects.size(); j++)
-                mSubTrees[i]->findAllCollidingDescendants(*mQuadObjects[j], pairs);
+            auto child = n.mFirstChild + i;
+
+            #pragma omp task firstprivate(child) if(mNodes[child].mSubtreeEnd - mNodes[child].mBegin >= TASK_MIN_OBJECTS)
+            findAllCollidingPairs(child);
         }
-        for (auto& subTree : mSubTrees)
-            subTree->findAllCollidingPairs(pairs);
     }
 }
 
-void QuadTreeDetector::QuadTreeNode::findAllCollidingDescendants(QuadTreeObject& object, Pairs& pairs)
+void QuadTreeDetector::findAllCollidingDescendants(size_t node, size_t object, Pairs& pairs)
 {
-    for (size_t i = 0; i < mQuadObjects.size(); i++)
+    // descendants are stored right after the node's own objects
+    const auto& n = mNodes[node];
+    collectOverlaps(object, n.mEnd, n.mSubtreeEnd, pairs);
+}
+
+void QuadTreeDetector::collectOverlaps(size_t object, size_t begin, size_t end, Pairs& pairs) const
+{
+    const auto& o = mNodeObjects;
+    auto minX = o.minX[object];
+    auto minY = o.minY[object];
+    auto maxX = o.maxX[object];
+    auto maxY = o.maxY[object];
+
+    for (auto i = begin; i < end; i += AABB_BATCH_SIZE)
+    {
+        auto mask = overlapMask(minX, minY, maxX, maxY, o.minX.data() + i, o.minY.data() + i, o.maxX.data() + i, o.maxY.data() + i);
+        if (end - i < AABB_BATCH_SIZE)
+            mask &= (1u << (end - i)) - 1;
+
+        for (; mask; mask &= mask - 1)
+            pairs.emplace_back(o.objectIDs[object], o.objectIDs[i + std::countr_zero(mask)]);
+    }
+}
+
+void QuadTreeDetector::findAllLoosePairs()
+{
+    // loose siblings overlap, so every object queries the tree on its own;
+    // a pair is reported by the object stored first in mNodeObjects
+    #pragma omp parallel
     {
-        if (object.intersects(*mQuadObjects[i]))
+        auto& pairs = mThreadPairs[omp_get_thread_num()];
+        std::vector<size_t> stack;
+
+        #pragma omp for schedule(dynamic, 64) nowait
+        for (size_t i = 0; i < mNodes[0].mSubtreeEnd; i++)
         {
-            #pragma omp critical (pairs)
-            pairs.emplace_back(object.objectID, mQuadObjects[i]->objectID);
+            glm::vec2 minBound = { mNodeObjects.minX[i], mNodeObjects.minY[i] };
+            glm::vec2 maxBound = { mNodeObjects.maxX[i], mNodeObjects.maxY[i] };
+            stack.assign(1, 0);
+
+            while (!stack.empty())
+            {
+                auto node = stack.back();
+                stack.pop_back();
+
+                // objects outside of the area stay in the root, it's always searched
+                const auto& n = mNodes[node];
+                if (n.mSubtreeEnd <= i + 1 || (node != 0 && !n.intersects(minBound, maxBound)))
+                    continue;
+
+                collectOverlaps(i, glm::max(n.mBegin, i + 1), n.mEnd, pairs);
+
+                if (!n.isLeaf())
+                    for (size_t c = 0; c < 4; c++)
+                        stack.push_back(n.mFirstChild + c);
+            }
         }
     }
-
-    if (!isLeaf())
-        for (size_t i = 0; i < mSubTrees.size(); i++)
-            mSubTrees[i]->findAllCollidingDescendants(object, pairs);
 }
 
-bool QuadTreeDetector::QuadTreeNode::intersects(QuadTreeObject& object)
+bool QuadTreeDetector::QuadTreeNode::intersects(glm::vec2 minBound, glm::vec2 maxBound) const
 {
-    return object.minBound.x < mBotRight.x && object.maxBound.x > mTopLeft.x && object.minBound.y < mBotRight.y && object.maxBound.y > mTopLeft.y;
+    return minBound.x < mLooseBotRight.x && maxBound.x > mLooseTopLeft.x && minBound.y < mLooseBotRight.y && maxBound.y > mLooseTopLeft.y;
 }
 
-bool QuadTreeDetector::QuadTreeObject::intersects(QuadTreeObject& object)
+void QuadTreeDetector::NodeObjects::resize(size_t size)
 {
-    return minBound.x < object.maxBound.x && maxBound.x > object.minBound.x && minBound.y < object.maxBound.y && maxBound.y > object.minBound.y;
+    // padded by a batch so the overlap kernel can always load full batches
+    minX.resize(size + AABB_BATCH_SIZE);
+    minY.resize(size + AABB_BATCH_SIZE);
+    maxX.resize(size + AABB_BATCH_SIZE);
+    maxY.resize(size + AABB_BATCH_SIZE);
+    objectIDs.resize(size);
 }
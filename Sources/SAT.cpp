@@ -1,34 +1,24 @@
 #include "SAT.hpp"
+#include "NarrowPhase.hpp"
 
 SAT::SAT(const Hull& a, const Hull& b)
 	: NarrowPhaseDetector(a, b)
+	, mStorageA(a)
+	, mStorageB(b)
 {
 }
 
 SAT::operator bool()
 {
-	bool separated = false;
-	
-	auto hullNormals = getNormals(mHullA);
-	for (size_t i = 0; i < hullNormals.size() && !separated; i++)
-	{
-		auto result1 = getMinMax(mHullA, hullNormals[i]);
-		auto result2 = getMinMax(mHullB, hullNormals[i]);
-		separated = result1.max < result2.min || result2.max < result1.min;
-	}
-
-	if (!separated)
-	{
-		hullNormals = getNormals(mHullB);
-		for (size_t i = 0; i < hullNormals.size() && !separated; i++)
-		{
-			auto result1 = getMinMax(mHullA, hullNormals[i]);
-			auto result2 = getMinMax(mHullB, hullNormals[i]);
-			separated = result1.max < result2.min || result2.max < result1.min;
-		}
-	}
+	return SATPolicy::intersects(mStorageA.view(), mStorageB.view());
+}
 
-	return !separated;
+void SAT::setHulls(const Hull& a, const Hull& b)
+{
+	mHullA = a;
+	mHullB = b;
+	mStorageA = HullStorage(a);
+	mStorageB = HullStorage(b);
 }
 
 std::vector<glm::vec2> SAT::getNormals(const Hull& hull)
@@ -44,30 +34,16 @@ std::vector<glm::vec2> SAT::getNormals(const Hull& hull)
 	return normals;
 }
 
-SAT::MinMaxResult SAT::getMinMax(const Hull& hull, const glm::vec2& axis)
+SAT::MinMaxResult SAT::getMinMax(const HullStorage& hull, const glm::vec2& axis)
 {
-	auto min = std::numeric_limits<float>::max();
-	auto max = std::numeric_limits<float>::lowest();
-	size_t minIndex = 0;
-	size_t maxIndex = 0;
+	auto view = hull.view();
 
-	for (size_t i = 0; i < hull.size(); i++)
-	{
-		auto currentProjection = glm::dot(hull[i], axis);
-		//select the maximum projection on axis to corresponding box corners
-		if (currentProjection < min)
-		{
-			min = currentProjection;
-			minIndex = i;
-		}
-		//select the minimum projection on axis to corresponding box corners
-		if (currentProjection > max)
-		{
-			max = currentProjection;
-			maxIndex = i;
-		}
-		max = glm::max(max, currentProjection);
-	}
+	float min, max;
+	projectHull(view.x, view.y, view.paddedSize(), axis.x, axis.y, min, max);
+
+	// extreme corners along the axis, the visualizer connects them to the projection
+	size_t minIndex = maxDotIndex(view.x, view.y, view.paddedSize(), -axis.x, -axis.y);
+	size_t maxIndex = maxDotIndex(view.x, view.y, view.paddedSize(), axis.x, axis.y);
 
 	return { min, minIndex, max, maxIndex };
 }
@@ -79,8 +55,7 @@ SATVisualizer::SATVisualizer()
 
 void SATVisualizer::simulate(const Hull& a, const Hull& b)
 {
-	mHullA = a;
-	mHullB = b;
+	setHulls(a, b);
 
 	mDrawStack.clear();
 	DrawCall drawCall;
@@ -274,8 +249,8 @@ void SATVisualizer::simulate(const Hull& a, const Hull& b)
 	auto hullNormals = getNormals(mHullA);
 	for (size_t i = 0; i < hullNormals.size() && !separated; i++)
 	{
-		auto result1 = getMinMax(mHullA, hullNormals[i]);
-		auto result2 = getMinMax(mHullB, hullNormals[i]);
+		auto result1 = getMinMax(mStorageA, hullNormals[i]);
+		auto result2 = getMinMax(mStorageB, hullNormals[i]);
 		separated = result1.max < result2.min || result2.max < result1.min;
 
 		auto start = (mHullA[(i + 1) % hullNormals.size()] + mHullA[i]) * 0.5f;
@@ -321,8 +296,8 @@ void SATVisualizer::simulate(const Hull& a, const Hull& b)
 		hullNormals = getNormals(mHullB);
 		for (size_t i = 0; i < hullNormals.size() && !separated; i++)
 		{
-			auto result1 = getMinMax(mHullA, hullNormals[i]);
-			auto result2 = getMinMax(mHullB, hullNormals[i]);
+			auto result1 = getMinMax(mStorageA, hullNormals[i]);
+			auto result2 = getMinMax(mStorageB, hullNormals[i]);
 			separated = result1.max < result2.min || result2.max < result1.min;
 
 			auto start = (mHullB[(i + 1) % hullNormals.size()] + mHullB[i]) * 0.5f;
@@ -0,0 +1,165 @@
+#include "SweepAndPrune.hpp"
+#include <algorithm>
+#include <limits>
+
+Pairs SweepAndPrune::generatePairs()
+{
+	updateBounds();
+
+	float maxWidth = 0.f;
+
+	#pragma omp parallel for schedule(static) reduction(max:maxWidth)
+	for (CollisionID i = 0; i < mObjects.size(); ++i)
+		maxWidth = std::max(maxWidth, mBounds[i].max.x - mBounds[i].min.x);
+
+	mMaxWidth = maxWidth;
+
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		auto& endpoints = mEndpoints[axis];
+
+		#pragma omp parallel for schedule(static)
+		for (size_t i = 0; i < endpoints.size(); ++i)
+		{
+			auto& e = endpoints[i];
+			e.value = e.isMin ? mBounds[e.objectID].min[axis] : mBounds[e.objectID].max[axis];
+		}
+	}
+
+	if (mRebuild)
+		rebuild();
+	else
+	{
+		sortAxis(0);
+		sortAxis(1);
+	}
+
+	return mPairs;
+}
+
+void SweepAndPrune::queryBounds(const AABB& region, std::vector<CollisionID>& candidates) const
+{
+	// intervals overlapping the region start within the widest interval left of it
+	const auto& endpoints = mEndpoints[0];
+	auto begin = std::lower_bound(endpoints.begin(), endpoints.end(), region.min.x - mMaxWidth,
+		[](const Endpoint& e, float value) { return e.value < value; });
+
+	for (auto e = begin; e != endpoints.end() && e->value < region.max.x; ++e)
+		if (e->isMin && mBounds[e->objectID].intersects(region))
+			candidates.emplace_back(e->objectID);
+}
+
+void SweepAndPrune::onColliderAddition()
+{
+	// new endpoints land at the end, the next frame sorts them into place
+	CollisionID id = mObjects.size() - 1;
+	for (auto& endpoints : mEndpoints)
+	{
+		endpoints.push_back({ std::numeric_limits<float>::max(), id, true });
+		endpoints.push_back({ std::numeric_limits<float>::max(), id, false });
+	}
+
+	mActiveIndex.resize(mObjects.size());
+	mRebuild = true;
+}
+
+void SweepAndPrune::rebuild()
+{
+	for (auto& endpoints : mEndpoints)
+		std::sort(endpoints.begin(), endpoints.end());
+
+	mPairs.clear();
+	mPairIndex.clear();
+	mActive.clear();
+	std::fill(mActiveIndex.begin(), mActiveIndex.end(), NOT_ACTIVE);
+
+	for (const auto& e : mEndpoints[0])
+	{
+		if (e.isMin)
+		{
+			const auto& bound = mBounds[e.objectID];
+			for (auto other : mActive)
+				if (bound.intersects(mBounds[other]))
+					addPair(other, e.objectID);
+
+			// without X extent the object closed on the tie before it opened, it never becomes active
+			if (mActiveIndex[e.objectID] == CLOSED)
+				continue;
+
+			mActiveIndex[e.objectID] = mActive.size();
+			mActive.emplace_back(e.objectID);
+		}
+		else if (mActiveIndex[e.objectID] == NOT_ACTIVE)
+			mActiveIndex[e.objectID] = CLOSED;
+		else
+		{
+			// swap remove from the active set
+			auto index = mActiveIndex[e.objectID];
+			mActive[index] = mActive.back();
+			mActiveIndex[mActive[index]] = index;
+			mActive.pop_back();
+		}
+	}
+
+	mRebuild = false;
+}
+
+void SweepAndPrune::sortAxis(size_t axis)
+{
+	auto& endpoints = mEndpoints[axis];
+
+	// insertion sort, O(N + swaps) on nearly sorted input
+	for (size_t i = 1; i < endpoints.size(); ++i)
+	{
+		auto e = endpoints[i];
+		size_t j = i;
+		for (; j > 0 && e < endpoints[j - 1]; --j)
+		{
+			const auto& passed = endpoints[j - 1];
+
+			// a min passing a max starts an overlap on this axis, the pair is added if the boxes
+			// overlap on the other one as well; a max passing a min ends the overlap
+			if (e.objectID != passed.objectID)
+			{
+				if (e.isMin && !passed.isMin)
+				{
+					if (mBounds[e.objectID].intersects(mBounds[passed.objectID]))
+						addPair(e.objectID, passed.objectID);
+				}
+				else if (!e.isMin && passed.isMin)
+					removePair(e.objectID, passed.objectID);
+			}
+
+			endpoints[j] = passed;
+		}
+		endpoints[j] = e;
+	}
+}
+
+void SweepAndPrune::addPair(CollisionID a, CollisionID b)
+{
+	if (a > b)
+		std::swap(a, b);
+
+	if (mPairIndex.try_emplace(pairKey(a, b), mPairs.size()).second)
+		mPairs.emplace_back(a, b);
+}
+
+void SweepAndPrune::removePair(CollisionID a, CollisionID b)
+{
+	if (a > b)
+		std::swap(a, b);
+
+	auto it = mPairIndex.find(pairKey(a, b));
+	if (it == mPairIndex.end())
+		return;
+
+	// swap remove, the moved pair gets the freed slot
+	auto index = it->second;
+	mPairIndex.erase(it);
+	mPairs[index] = mPairs.back();
+	mPairs.pop_back();
+
+	if (index < mPairs.size())
+		mPairIndex[pairKey(mPairs[index].first, mPairs[index].second)] = index;
+}